@@ -129,6 +129,8 @@ For testing the applications, the library provides videos and the corresponding
 */
 
 #include "markerdetector.h"
+#include "markerdecoder.h"
 #include "boarddetector.h"
+#include "markertracker.h"
 #include "cvdrawingutils.h"
 
@@ -66,12 +66,28 @@ namespace aruco {
     *
     */
     float  BoardDetector::detect ( const cv::Mat &im ) throw ( cv::Exception ) {
-        _mdetector.detect ( im,_vmarkers );
-
+        //with the camera parameters, LINES refinement takes into account the distortion using their precomputed table
+        if ( _camParams.isValid() ) _mdetector.detect ( im,_vmarkers,_camParams );
+        else _mdetector.detect ( im,_vmarkers );
+        return detectBoard();
+    }
+    /**
+    *
+    *
+    */
+    float  BoardDetector::detect ( const ImagePyramid &pyramid ) throw ( cv::Exception ) {
+        _mdetector.detect ( pyramid,_vmarkers,_camParams );
+        return detectBoard();
+    }
+    /**
+    *
+    *
+    */
+    float  BoardDetector::detectBoard() {
         float res;
 
         if ( _camParams.isValid() )
-            res=detect ( _vmarkers,_bconf,_boardDetected,_camParams.CameraMatrix,_camParams.Distorsion,_markerSize );
+            res=detect ( _vmarkers,_bconf,_boardDetected,_camParams.CameraMatrix,_camParams.getActiveDistorsion(),_markerSize );
         else res=detect ( _vmarkers,_bconf,_boardDetected );
         return res;
     }
@@ -80,7 +96,7 @@ namespace aruco {
     *
     */
     float BoardDetector::detect ( const vector<Marker> &detectedMarkers,const  BoardConfiguration &BConf, Board &Bdetected,const CameraParameters &cp, float markerSizeMeters ) throw ( cv::Exception ) {
-        return detect ( detectedMarkers, BConf,Bdetected,cp.CameraMatrix,cp.Distorsion,markerSizeMeters );
+        return detect ( detectedMarkers, BConf,Bdetected,cp.CameraMatrix,cp.getActiveDistorsion(),markerSizeMeters );
     }
     /**
     *
@@ -81,12 +81,19 @@ public:
      * @return value indicating  the  likelihood of having found the marker
      */
     float  detect(const cv::Mat &im)throw (cv::Exception);
+    /**
+     * Same as above, but the markers are detected in a pyramid of the grey image already built (see MarkerDetector::detect)
+     */
+    float  detect(const ImagePyramid &pyramid)throw (cv::Exception);
     /**Returns a reference to the board detected
      */
     Board & getDetectedBoard(){return _boardDetected;}
     /**Returns a reference to the internal marker detector
      */
     MarkerDetector &getMarkerDetector(){return _mdetector;}
+    /**Returns the pyramid of the grey image built by the internal marker detector in the last call to detect(im)
+     */
+    const ImagePyramid &getImagePyramid()const{return _mdetector.getImagePyramid();}
     /**Returns the vector of markers detected
      */
     vector<Marker> &getDetectedMarkers(){return _vmarkers;}
@@ -135,6 +142,8 @@ public:
     
     
 private:
+    //looks for the board in the markers detected (_vmarkers)
+    float detectBoard();
     void rotateXAxis(cv::Mat &rotation);
     bool _setYPerpendicular;
     
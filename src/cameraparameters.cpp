@@ -34,10 +34,35 @@ namespace aruco
 {
 
 
+/**
+ */
+DistortionModel::DistortionModel(const cv::Mat &cameraMatrix,const cv::Mat &distorsionCoeff)
+{
+    _valid=cameraMatrix.rows==3 && cameraMatrix.cols==3 && distorsionCoeff.total()>=4;
+    if (!_valid) return;
+    cv::Mat cam,dist;
+    cameraMatrix.convertTo(cam,CV_64F);
+    distorsionCoeff.reshape(1,distorsionCoeff.total()).convertTo(dist,CV_64F);
+    _fx=cam.at<double>(0,0);
+    _fy=cam.at<double>(1,1);
+    _cx=cam.at<double>(0,2);
+    _cy=cam.at<double>(1,2);
+    _k1=dist.at<double>(0,0);
+    _k2=dist.at<double>(1,0);
+    _p1=dist.at<double>(2,0);
+    _p2=dist.at<double>(3,0);
+    _k3=dist.total()>4?dist.at<double>(4,0):0;
+}
+
+/**
+ */
 CameraParameters::CameraParameters() {
     CameraMatrix=cv::Mat();
     Distorsion=cv::Mat();
     CamSize=cv::Size(-1,-1);
+    _preUndistorted=false;
+    _useUndistortTable=false;
+    invalidateMaps();
 }
 /**Creates the object from the info passed
  * @param cameraMatrix 3x3 matrix (fx 0 cx, 0 fy cy, 0 0 1)
@@ -45,6 +70,8 @@ CameraParameters::CameraParameters() {
  * @param size image size
  */
 CameraParameters::CameraParameters(cv::Mat cameraMatrix,cv::Mat distorsionCoeff,cv::Size size) throw(cv::Exception) {
+    _preUndistorted=false;
+    _useUndistortTable=false;
     setParams(cameraMatrix,distorsionCoeff,size);
 }
 /**
@@ -53,14 +80,21 @@ CameraParameters::CameraParameters(const CameraParameters &CI) {
     CI.CameraMatrix.copyTo(CameraMatrix);
     CI.Distorsion.copyTo(Distorsion);
     CamSize=CI.CamSize;
+    _preUndistorted=CI._preUndistorted;
+    _useUndistortTable=CI._useUndistortTable;
+    invalidateMaps();
 }
 
 /**
 */
 CameraParameters & CameraParameters::operator=(const CameraParameters &CI) {
+    if (&CI==this) return *this;
     CI.CameraMatrix.copyTo(CameraMatrix);
     CI.Distorsion.copyTo(Distorsion);
     CamSize=CI.CamSize;
+    _preUndistorted=CI._preUndistorted;
+    _useUndistortTable=CI._useUndistortTable;
+    invalidateMaps();
     return *this;
 }
 /**
@@ -81,6 +115,7 @@ void CameraParameters::setParams(cv::Mat cameraMatrix,cv::Mat distorsionCoeff,cv
 //         Distorsion.ptr<float>(0)[i]=auxD.ptr<float>(0)[i];
 
     CamSize=size;
+    invalidateMaps();
 
 }
 
@@ -134,6 +169,7 @@ void CameraParameters::readFromFile(string path)throw(cv::Exception)
             else if (scmd=="height") CamSize.height=fval;
         }
     }
+    invalidateMaps();
 }
 /**Saves this to a file
   */
@@ -178,6 +214,8 @@ void CameraParameters::resize(cv::Size size)throw(cv::Exception)
     CameraMatrix.at<float>(0,2)*=AxFactor;
     CameraMatrix.at<float>(1,1)*=AyFactor;
     CameraMatrix.at<float>(1,2)*=AyFactor;
+    CamSize=size;
+    invalidateMaps();
 }
 
 /****
@@ -216,6 +254,148 @@ void CameraParameters::readFromXMLFile(string filePath)throw(cv::Exception)
         Distorsion.ptr<float>(0)[i]=mdist32.ptr<float>(0)[i];
     CamSize.width=w;
     CamSize.height=h;
+    invalidateMaps();
+}
+
+/****
+ *
+ *
+ *
+ *
+ */
+bool CameraParameters::hasActiveDistorsion()const
+{
+    return !_preUndistorted && CameraMatrix.rows==3 && CameraMatrix.cols==3 && Distorsion.total()>=4 && cv::countNonZero(Distorsion)!=0;
+}
+
+/****
+ *
+ *
+ *
+ *
+ */
+void CameraParameters::invalidateMaps()
+{
+    _undistortMapX=cv::Mat();
+    _undistortMapY=cv::Mat();
+    _undistortTable=cv::Mat();
+    _undistortTableError=-1;
+    if (hasActiveDistorsion()) {
+        _model=DistortionModel(CameraMatrix,Distorsion);
+        if (_useUndistortTable) buildUndistortTable();
+    }
+    else _model=DistortionModel();
+}
+
+/****
+ *
+ *
+ *
+ *
+ */
+void CameraParameters::buildUndistortTable()
+{
+    //maximum error allowed to the interpolation (pixels)
+    const float maxError=0.05f;
+    if (CamSize.width<=0 || CamSize.height<=0) return;
+    //table with the undistorted location of the nodes of a grid that covers the whole image
+    int cols=CamSize.width/UndistortTableStep+2;
+    int rows=CamSize.height/UndistortTableStep+2;
+    _undistortTable.create(rows,cols,CV_32FC2);
+    for (int y=0;y<rows;y++) {
+        cv::Point2f *row=_undistortTable.ptr<cv::Point2f>(y);
+        for (int x=0;x<cols;x++)
+            row[x]=_model.undistort(cv::Point2f(x*UndistortTableStep,y*UndistortTableStep));
+    }
+    //error of the interpolation in the center of the cells
+    float error=0;
+    float half=UndistortTableStep*0.5f;
+    for (int y=0;y<rows-1;y++) {
+        const cv::Point2f *r0=_undistortTable.ptr<cv::Point2f>(y),*r1=_undistortTable.ptr<cv::Point2f>(y+1);
+        for (int x=0;x<cols-1;x++) {
+            cv::Point2f interp=(r0[x]+r0[x+1]+r1[x]+r1[x+1])*0.25f;
+            cv::Point2f exact=_model.undistort(cv::Point2f(x*UndistortTableStep+half,y*UndistortTableStep+half));
+            error=std::max(error,float(cv::norm(interp-exact)));
+        }
+    }
+    if (error>maxError) _undistortTable=cv::Mat();
+    else _undistortTableError=error;
+}
+
+/****
+ *
+ *
+ *
+ *
+ */
+void CameraParameters::prepareMaps(bool denseMaps)const
+{
+    if (!denseMaps) return;
+    //the only data built lazily
+    #pragma omp critical(aruco_camera_parameters_maps)
+    {
+        if (_undistortMapX.empty() && isValid())
+            cv::initUndistortRectifyMap(CameraMatrix,getActiveDistorsion(),cv::Mat(),CameraMatrix,CamSize,CV_32FC1,_undistortMapX,_undistortMapY);
+    }
+}
+
+/****
+ *
+ *
+ *
+ *
+ */
+cv::Point2f CameraParameters::undistortPoint(const cv::Point2f &p)const
+{
+    if (!_model.isValid()) return p;
+    if (_undistortTable.empty()) return _model.undistort(p);
+    float fx=p.x/UndistortTableStep,fy=p.y/UndistortTableStep;
+    int ix=cvFloor(fx),iy=cvFloor(fy);
+    if (ix<0 || iy<0 || ix>=_undistortTable.cols-1 || iy>=_undistortTable.rows-1) return _model.undistort(p);
+    float ax=fx-ix,ay=fy-iy;
+    const cv::Point2f *r0=_undistortTable.ptr<cv::Point2f>(iy)+ix;
+    const cv::Point2f *r1=_undistortTable.ptr<cv::Point2f>(iy+1)+ix;
+    return (r0[0]*(1-ax)+r0[1]*ax)*(1-ay)+(r1[0]*(1-ax)+r1[1]*ax)*ay;
+}
+
+/****
+ *
+ *
+ *
+ *
+ */
+cv::Point2f CameraParameters::distortPoint(const cv::Point2f &p)const
+{
+    if (!_model.isValid()) return p;
+    return _model.distort(p);
+}
+
+/****
+ *
+ *
+ *
+ *
+ */
+void CameraParameters::getUndistortMaps(cv::Mat &mapx,cv::Mat &mapy)const throw(cv::Exception)
+{
+    if (!isValid()) throw cv::Exception(9007,"invalid object","CameraParameters::getUndistortMaps",__FILE__,__LINE__);
+    prepareMaps(true);
+    mapx=_undistortMapX;
+    mapy=_undistortMapY;
+}
+
+/****
+ *
+ *
+ *
+ *
+ */
+void CameraParameters::undistort(const cv::Mat &in,cv::Mat &out)const throw(cv::Exception)
+{
+    if (in.size()!=CamSize) throw cv::Exception(9007,"in.size()!=CamSize","CameraParameters::undistort",__FILE__,__LINE__);
+    cv::Mat mapx,mapy;
+    getUndistortMaps(mapx,mapy);
+    cv::remap(in,out,mapx,mapy,cv::INTER_LINEAR);
 }
 /****
  *
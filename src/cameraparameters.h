@@ -33,7 +33,59 @@ or implied, of Rafael Muñoz Salinas.
 using namespace std;
 namespace aruco
 {
+/**\brief Pinhole model with the distortion model of opencv (k1,k2,p1,p2[,k3]).
+ * The coefficients are read once, so that points can be distorted and undistorted one by one without allocating memory.
+ * Points are expressed in pixels in both cases.
+ */
+class ARUCO_EXPORTS DistortionModel
+{
+public:
+    DistortionModel():_valid(false){}
+    /**
+     * @param cameraMatrix 3x3 matrix (fx 0 cx, 0 fy cy, 0 0 1) CV_32F or CV_64F
+     * @param distorsionCoeff matrix with 4 or 5 elements (k1,k2,p1,p2[,k3]) CV_32F or CV_64F
+     */
+    DistortionModel(const cv::Mat &cameraMatrix,const cv::Mat &distorsionCoeff);
+    /**Indicates whether the camera matrix and the distortion coefficients were given
+     */
+    bool isValid()const{return _valid;}
+    /**Same iterative method than cv::undistortPoints, using the camera matrix as new projection matrix
+     */
+    cv::Point2f undistort(const cv::Point2f &p)const
+    {
+        double x0=(p.x-_cx)/_fx,y0=(p.y-_cy)/_fy;
+        double x=x0,y=y0;
+        for (int i=0;i<5;i++) {
+            double r2=x*x+y*y;
+            double icdist=1./(1+((_k3*r2+_k2)*r2+_k1)*r2);
+            double dx=2*_p1*x*y+_p2*(r2+2*x*x);
+            double dy=_p1*(r2+2*y*y)+2*_p2*x*y;
+            x=(x0-dx)*icdist;
+            y=(y0-dy)*icdist;
+        }
+        return cv::Point2f(x*_fx+_cx,y*_fy+_cy);
+    }
+    /**Same as cv::projectPoints with null rotation and translation
+     */
+    cv::Point2f distort(const cv::Point2f &p)const
+    {
+        double x=(p.x-_cx)/_fx,y=(p.y-_cy)/_fy;
+        double r2=x*x+y*y;
+        double radial=1+((_k3*r2+_k2)*r2+_k1)*r2;
+        double xd=x*radial+2*_p1*x*y+_p2*(r2+2*x*x);
+        double yd=y*radial+_p1*(r2+2*y*y)+2*_p2*x*y;
+        return cv::Point2f(xd*_fx+_cx,yd*_fy+_cy);
+    }
+private:
+    bool _valid;
+    double _fx,_fy,_cx,_cy,_k1,_k2,_p1,_p2,_k3;
+};
+
 /**\brief Parameters of the camera
+ *
+ * The distortion model (and the undistortion table, if enabled) is computed whenever the parameters change (setParams, resize, read
+ * functions or assignment), so points can be undistorted from several threads at the same time. The maps for undistorting images are
+ * built the first time they are needed. If you modify the public members directly, call invalidateMaps().
  */
 
 class ARUCO_EXPORTS  CameraParameters
@@ -123,7 +175,67 @@ public:
      */
     static cv::Mat getRTMatrix(const cv::Mat &R_,const cv::Mat &T_ ,int forceType);
 
+    /**Indicates that the images passed to the library are already undistorted (for instance, with undistort()).
+     * Then, getActiveDistorsion() returns an empty matrix and all the work related to the distortion is skipped
+     */
+    void setPreUndistorted(bool enable){_preUndistorted=enable;invalidateMaps();}
+    /**
+     */
+    bool isPreUndistorted()const{return _preUndistorted;}
+    /**Distortion that must be considered for the images passed: Distorsion, or an empty matrix if the images are pre-undistorted
+     */
+    const cv::Mat & getActiveDistorsion()const{return _preUndistorted?_noDistorsion:Distorsion;}
+    /**Indicates if there is distortion to be considered in the images passed
+     */
+    bool hasActiveDistorsion()const;
+
+    /**Undistorts an image of size CamSize with the maps precomputed for it
+     */
+    void undistort(const cv::Mat &in,cv::Mat &out)const throw(cv::Exception);
+    /**Returns the maps for cv::remap that undistort an image of size CamSize (CV_32FC1). They are computed only once
+     */
+    void getUndistortMaps(cv::Mat &mapx,cv::Mat &mapy)const throw(cv::Exception);
+    /**Returns the undistorted location of a point of the image (pixels), with the same iterative method than cv::undistortPoints.
+     * If the undistortion table is enabled (see setUndistortTable), it is bilinearly interpolated instead for the points in the image.
+     * If there is no active distortion, the point is returned unchanged
+     */
+    cv::Point2f undistortPoint(const cv::Point2f &p)const;
+    /**Applies the distortion to an undistorted point (pixels). Inverse of undistortPoint
+     */
+    cv::Point2f distortPoint(const cv::Point2f &p)const;
+    /**Builds now the dense maps for undistorting images if denseMaps is true (otherwise, they are built the first time they are needed).
+     * The rest of the precomputed data is always ready
+     */
+    void prepareMaps(bool denseMaps=false)const;
+    /**Recomputes the distortion model and the undistortion table, and discards the dense maps. Call it if you modify directly
+     * CameraMatrix, Distorsion or CamSize
+     */
+    void invalidateMaps();
+    /**Enables/disables the interpolation of a table of undistorted points (a node every 8 pixels) in undistortPoint, which is faster
+     * than the iterative method but approximate. When built, the table is checked against the iterative method in the center of each cell,
+     * where the interpolation error is the largest, and it is not employed if the error is above 0.05 pixels. Disabled by default
+     */
+    void setUndistortTable(bool enable){_useUndistortTable=enable;invalidateMaps();}
+    /**
+     */
+    bool isUndistortTableEnabled()const{return _useUndistortTable;}
+    /**Largest error (pixels) of the undistortion table measured when it was built, or -1 if it is not employed
+     */
+    float getUndistortTableError()const{return _undistortTableError;}
+
 private:
+    //distance in pixels between the nodes of the undistortion table
+    static const int UndistortTableStep=8;
+    bool _preUndistorted;
+    cv::Mat _noDistorsion;
+    //precomputed data, built when the parameters change
+    DistortionModel _model;
+    bool _useUndistortTable;
+    cv::Mat _undistortTable;//CV_32FC2, undistorted location of pixel (x*UndistortTableStep,y*UndistortTableStep)
+    float _undistortTableError;
+    //maps for undistorting images, built the first time they are needed
+    mutable cv::Mat _undistortMapX,_undistortMapY;
+    void buildUndistortTable();
     //GL routines
 
     static void argConvGLcpara2( double cparam[3][4], int width, int height, double gnear, double gfar, double m[16], bool invert )throw(cv::Exception);
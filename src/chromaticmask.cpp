@@ -171,13 +171,9 @@ void ChromaticMask::setParams(unsigned int mc, unsigned int nc, double threshPro
   _objCornerPoints = corners;
   _CP = CP;
   
-  _pixelsVector.clear();
-  for(unsigned int i=0; i<CP.CamSize.height/2; i++)
-    for(unsigned int j=0; j<CP.CamSize.width/2; j++)
-      _pixelsVector.push_back( cv::Point2f(2*j,2*i) );
-  
   resetMask();
   _cellMap = cv::Mat(CP.CamSize.height, CP.CamSize.width, CV_8UC1, cv::Scalar::all(0));
+  _cellMapRect = cv::Rect();
   _canonicalPos = cv::Mat(CP.CamSize.height, CP.CamSize.width, CV_8UC2);
     
   _cellCenters.resize(_classifiers.size());
@@ -190,55 +186,48 @@ void ChromaticMask::setParams(unsigned int mc, unsigned int nc, double threshPro
   
 }
 
-pair<double,double> AvrgTime(0,0) ;
-
 /**
  */
 void ChromaticMask::calculateGridImage(const aruco::Board &board )
 {
+  // vertices of the cells in the board, interpolated from its corners: corner 0 is the origin of the grid,
+  // corner 1 is at the end of the first row and corner 3 at the end of the first column
+  vector<cv::Point3f> objVertices;
+  objVertices.reserve((_mc+1)*(_nc+1));
+  for(unsigned int y=0; y<=_nc; y++) {
+    float v = float(y)/float(_nc);
+    for(unsigned int x=0; x<=_mc; x++) {
+      float u = float(x)/float(_mc);
+      objVertices.push_back( (1-u)*(1-v)*_objCornerPoints[0] + u*(1-v)*_objCornerPoints[1] + u*v*_objCornerPoints[2] + (1-u)*v*_objCornerPoints[3] );
+    }
+  }
   
-      // project corner points to image
-      cv::projectPoints(_objCornerPoints, board.Rvec, board.Tvec, _CP.CameraMatrix, _CP.Distorsion, _imgCornerPoints);    
-
-      //obtain the perspective transform
-      cv::Point2f  pointsRes[4],pointsIn[4];
-      for ( int i=0;i<4;i++ ) pointsIn[i]=_imgCornerPoints[i];
-      pointsRes[0]= ( cv::Point2f ( 0,0 ) );
-      pointsRes[1]= cv::Point2f ( _cellSize*_mc-1, 0 );
-      pointsRes[2]= cv::Point2f ( _cellSize*_mc-1, _cellSize*_nc-1 );
-      pointsRes[3]= cv::Point2f ( 0, _cellSize*_nc-1 );
-      _perpTrans=cv::getPerspectiveTransform ( pointsIn,pointsRes );
-      
-double tick = (double)cv::getTickCount();	
-		
-      vector<cv::Point2f> transformedPixels;
-      cv::perspectiveTransform(_pixelsVector, transformedPixels, _perpTrans);        
-		
-             AvrgTime.first+=((double)cv::getTickCount()-tick)/cv::getTickFrequency(); AvrgTime.second++;      
- 	    cout<<"Time cc detection="<<1000*AvrgTime.first/AvrgTime.second<<" milliseconds"<<endl;		
-      
- 
-            
-      cv::Rect cellRect(0,0,_mc,_nc);
-      for(unsigned int i=0; i<transformedPixels.size(); i++) {
-	//_canonicalPos.at<cv::Vec2b>(_pixelsVector[i].y, _pixelsVector[i].x) = cv::Vec2b(transformedPixels[i].x, transformedPixels[i].y);
-	transformedPixels[i].x /= _cellSize;
-	transformedPixels[i].y /= _cellSize;
-	if( !transformedPixels[i].inside(cellRect) ) {
-	  _cellMap.at<uchar>( _pixelsVector[i].y, _pixelsVector[i].x ) = 0;
-	  _cellMap.at<uchar>( _pixelsVector[i].y+1, _pixelsVector[i].x ) = 0;
-	  _cellMap.at<uchar>( _pixelsVector[i].y, _pixelsVector[i].x+1 ) = 0;
-	  _cellMap.at<uchar>( _pixelsVector[i].y+1, _pixelsVector[i].x+1 ) = 0;
-	}
-	else {
-      uchar cellNum = (unsigned int)transformedPixels[i].y*_nc + (unsigned int)transformedPixels[i].x;
-	  _cellMap.at<uchar>( _pixelsVector[i].y, _pixelsVector[i].x ) = 1+cellNum;
-	  _cellMap.at<uchar>( _pixelsVector[i].y+1, _pixelsVector[i].x ) = 1+cellNum;	  
-	  _cellMap.at<uchar>( _pixelsVector[i].y, _pixelsVector[i].x+1 ) = 1+cellNum;
-	  _cellMap.at<uchar>( _pixelsVector[i].y+1, _pixelsVector[i].x+1 ) = 1+cellNum;	  
-	}
-      }
-          
+  // project them once for this pose
+  vector<cv::Point2f> imgVertices;
+  cv::projectPoints(objVertices, board.Rvec, board.Tvec, _CP.CameraMatrix, _CP.getActiveDistorsion(), imgVertices);
+  
+  // only the region of the last board and the one of the current board are modified
+  cv::Rect imRect(0,0,_cellMap.cols,_cellMap.rows);
+  if(_cellMapRect.area()>0) _cellMap(_cellMapRect).setTo(cv::Scalar::all(0));
+  _cellMapRect = cv::boundingRect(imgVertices);
+  _cellMapRect.width++;
+  _cellMapRect.height++;
+  _cellMapRect &= imRect;
+  if(_cellMapRect.area()==0) return;
+  
+  // rasterize each cell
+  cv::Point poly[4];
+  for(unsigned int y=0; y<_nc; y++) {
+    for(unsigned int x=0; x<_mc; x++) {
+      unsigned int v0 = y*(_mc+1)+x;
+      poly[0] = imgVertices[v0];
+      poly[1] = imgVertices[v0+1];
+      poly[2] = imgVertices[v0+_mc+2];
+      poly[3] = imgVertices[v0+_mc+1];
+      uchar cellNum = y*_nc + x;
+      cv::fillConvexPoly(_cellMap, poly, 4, cv::Scalar::all(1+cellNum));
+    }
+  }
 }
 
 
@@ -251,8 +240,9 @@ void ChromaticMask::train(const cv::Mat& in, const aruco::Board &board)
   
   for(unsigned int i=0; i<_classifiers.size(); i++) _classifiers[i].clearSamples();
   
-  for(unsigned int i=0; i<in.rows; i++) {
-    for(unsigned int j=0; j<in.cols; j++) {
+  // the cell map is empty out of the board
+  for(int i=_cellMapRect.y; i<_cellMapRect.y+_cellMapRect.height; i++) {
+    for(int j=_cellMapRect.x; j<_cellMapRect.x+_cellMapRect.width; j++) {
       uchar idx = _cellMap.at<uchar>(i,j);
       if(idx!=0) _classifiers[idx-1].addSample( in.at<uchar>(i,j) );
     }
@@ -298,10 +288,10 @@ void ChromaticMask::classify(const cv::Mat& in, const aruco::Board &board)
   
   resetMask();
   
-  for(unsigned int i=0; i<in.rows; i++) {
+  for(int i=_cellMapRect.y; i<_cellMapRect.y+_cellMapRect.height; i++) {
     const uchar* in_ptr = in.ptr<uchar>(i);
     const uchar* _cellMap_ptr = _cellMap.ptr<uchar>(i);
-    for(unsigned int j=0; j<in.cols; j++) {
+    for(int j=_cellMapRect.x; j<_cellMapRect.x+_cellMapRect.width; j++) {
       uchar idx = _cellMap_ptr[j];
       if(idx!=0) {
 	
@@ -356,7 +346,7 @@ void ChromaticMask::classify2(const cv::Mat& in, const aruco::Board &board)
     _maskAux.create(_CP.CamSize.height, _CP.CamSize.width, CV_8UC1); 
       _maskAux.setTo(cv::Scalar::all(0));
   
-      cv::projectPoints(_objCornerPoints, board.Rvec, board.Tvec, _CP.CameraMatrix, _CP.Distorsion, _imgCornerPoints);    
+      cv::projectPoints(_objCornerPoints, board.Rvec, board.Tvec, _CP.CameraMatrix, _CP.getActiveDistorsion(), _imgCornerPoints);    
       //obtain the perspective transform
       cv::Point2f  pointsRes[4],pointsIn[4];
       for ( int i=0;i<4;i++ ) pointsIn[i]=_imgCornerPoints[i];
@@ -83,6 +83,10 @@ public:
   void classify(const cv::Mat& in, const aruco::Board &board);
   void classify2(const cv::Mat& in, const aruco::Board &board);
   void update(const cv::Mat& in);
+  //same as above, reading the image from the pyramid of the detector (e.g., BoardDetector::getImagePyramid())
+  void train(const aruco::ImagePyramid& pyr, const aruco::Board &board) { train(pyr[0],board); }
+  void classify2(const aruco::ImagePyramid& pyr, const aruco::Board &board) { classify2(pyr[0],board); }
+  void update(const aruco::ImagePyramid& pyr) { update(pyr[0]); }
   
   bool isValid() {return _isValid;};
   void resetMask();
@@ -99,7 +103,6 @@ private:
   cv::Mat _perpTrans;
   vector<EMClassifier> _classifiers;
   vector<cv::Point2f> _centers;
-  vector<cv::Point2f> _pixelsVector;
   vector<cv::Point2f> _cellCenters;
   vector<vector<size_t> > _cell_neighbours;
   const float _cellSize;
@@ -109,6 +112,7 @@ private:
   aruco::BoardDetector _BD;
   aruco::CameraParameters _CP;
   cv::Mat _canonicalPos, _cellMap, _mask,_maskAux;
+  cv::Rect _cellMapRect; // region of _cellMap with the cells of the board (zero elsewhere)
   bool _isValid;
   double _threshProb;
 
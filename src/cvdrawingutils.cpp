@@ -54,7 +54,7 @@ void CvDrawingUtils::draw3dAxis(cv::Mat &Image,Marker &m,const CameraParameters
     objectPoints.at<float>(3,2)=size;
 
     vector<Point2f> imagePoints;
-    cv::projectPoints( objectPoints, m.Rvec,m.Tvec, CP.CameraMatrix,CP.Distorsion,   imagePoints);
+    cv::projectPoints( objectPoints, m.Rvec,m.Tvec, CP.CameraMatrix,CP.getActiveDistorsion(),   imagePoints);
 //draw lines of different colours
     cv::line(Image,imagePoints[0],imagePoints[1],Scalar(0,0,255,255),1,CV_AA);
     cv::line(Image,imagePoints[0],imagePoints[2],Scalar(0,255,0,255),1,CV_AA);
@@ -130,7 +130,7 @@ void CvDrawingUtils::draw3dCube(cv::Mat &Image,Marker &m,const CameraParameters
     }
 
     vector<Point2f> imagePoints;
-    projectPoints( objectPoints, m.Rvec,m.Tvec,  CP.CameraMatrix,CP.Distorsion,   imagePoints);
+    projectPoints( objectPoints, m.Rvec,m.Tvec,  CP.CameraMatrix,CP.getActiveDistorsion(),   imagePoints);
 //draw lines of different colours
     for (int i=0;i<4;i++)
         cv::line(Image,imagePoints[i],imagePoints[(i+1)%4],Scalar(0,0,255,255),1,CV_AA);
@@ -158,7 +158,7 @@ objectPoints.at<float>(2,0)=0;objectPoints.at<float>(2,1)=2*B[0].ssize;objectPoi
 objectPoints.at<float>(3,0)=0;objectPoints.at<float>(3,1)=0;objectPoints.at<float>(3,2)=2*B[0].ssize;
 
 vector<Point2f> imagePoints;
-projectPoints( objectPoints, B.Rvec,B.Tvec, CP.CameraMatrix, CP.Distorsion,   imagePoints);
+projectPoints( objectPoints, B.Rvec,B.Tvec, CP.CameraMatrix, CP.getActiveDistorsion(),   imagePoints);
 //draw lines of different colours
 cv::line(Image,imagePoints[0],imagePoints[1],Scalar(0,0,255,255),2,CV_AA);
 cv::line(Image,imagePoints[0],imagePoints[2],Scalar(0,255,0,255),2,CV_AA);
@@ -206,7 +206,7 @@ else {
 }
 
 vector<Point2f> imagePoints;
-projectPoints( objectPoints,B.Rvec,B.Tvec, CP.CameraMatrix, CP.Distorsion,   imagePoints);
+projectPoints( objectPoints,B.Rvec,B.Tvec, CP.CameraMatrix, CP.getActiveDistorsion(),   imagePoints);
 //draw lines of different colours
 for(int i=0;i<4;i++)
   cv::line(Image,imagePoints[i],imagePoints[(i+1)%4],Scalar(0,0,255,255),1,CV_AA);
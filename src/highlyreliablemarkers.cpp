@@ -384,6 +384,9 @@ namespace aruco {
       _orderD.push_back( std::pair<unsigned int,unsigned int>( (*D)[i].getId() ,i) );
     }
     std::sort(_orderD.begin(), _orderD.end());
+    _binaryTree.clear();
+    _root = -1;
+    if(_orderD.empty()) return; // empty tree, every search fails
     
     // calculate the number of levels of the tree 
     unsigned int levels=0;
@@ -398,6 +401,7 @@ namespace aruco {
     // calculate position of the root element
     unsigned int rootIdx = _orderD.size()/2;
     visited[rootIdx] = true; // mark it as visited
+    _root = rootIdx;
     
     // auxiliar vector to store the ids intervals (max and min) during the creation of the tree
     std::vector< std::pair<unsigned int, unsigned int> > intervals;
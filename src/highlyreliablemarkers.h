@@ -223,6 +223,8 @@ public:
   class BalancedBinaryTree {
     
   public:
+
+    BalancedBinaryTree():_root(-1) {}
        
     /**
     * Create the tree for dictionary D
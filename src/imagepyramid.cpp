@@ -0,0 +1,83 @@
+/*****************************
+Copyright 2011 Rafael Muñoz Salinas. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY Rafael Muñoz Salinas ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Rafael Muñoz Salinas OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of Rafael Muñoz Salinas.
+********************************/
+#include "imagepyramid.h"
+#include <opencv2/imgproc/imgproc.hpp>
+using namespace cv;
+namespace aruco
+{
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+ImagePyramid::ImagePyramid()
+{
+    _border=0;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void ImagePyramid::build(const cv::Mat &grey,int nLevels,int border)throw(cv::Exception)
+{
+    if (grey.type()!=CV_8UC1) throw cv::Exception(9001,"grey.type()!=CV_8UC1","ImagePyramid::build",__FILE__,__LINE__);
+    if (nLevels<1 || border<0) throw cv::Exception(9001,"invalid number of levels or border","ImagePyramid::build",__FILE__,__LINE__);
+    //the smallest level must have at least a few pixels
+    int maxLevels=1;
+    for (Size sz=grey.size(); maxLevels<nLevels && (sz.width+1)/2>=8 && (sz.height+1)/2>=8; maxLevels++)
+        sz=Size((sz.width+1)/2,(sz.height+1)/2);
+    nLevels=maxLevels;
+    if (border!=_border) _buffers.clear();
+    _border=border;
+    _levels.resize(nLevels);
+    if (int(_buffers.size())<nLevels) _buffers.resize(nLevels);
+
+    Size sz=grey.size();
+    for (int l=0;l<nLevels;l++)
+    {
+        if (l>0) sz=Size((sz.width+1)/2,(sz.height+1)/2);
+        if (l==0 && _border==0) {
+            _levels[0]=grey;
+            continue;
+        }
+        //create (only reallocated if the size changes) the buffer and obtain the level as its region of interest
+        _buffers[l].create(sz.height+2*_border,sz.width+2*_border,CV_8UC1);
+        _levels[l]=_buffers[l](Rect(_border,_border,sz.width,sz.height));
+        if (l==0) grey.copyTo(_levels[0]);
+        else cv::pyrDown(_levels[l-1],_levels[l],sz);
+        if (_border>0)
+            copyMakeBorder(_levels[l],_buffers[l],_border,_border,_border,_border,BORDER_REFLECT_101|BORDER_ISOLATED);
+    }
+}
+
+};
@@ -0,0 +1,81 @@
+/*****************************
+Copyright 2011 Rafael Muñoz Salinas. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY Rafael Muñoz Salinas ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Rafael Muñoz Salinas OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of Rafael Muñoz Salinas.
+********************************/
+#ifndef _Aruco_ImagePyramid_H
+#define _Aruco_ImagePyramid_H
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include "exports.h"
+namespace aruco
+{
+/**\brief Gaussian pyramid of a grey image
+ *
+ * Level 0 is the image itself, and each level is the pyrDown of the previous one.
+ * The buffers are kept between calls to build, so that no memory is allocated when the image size does not change.
+ * Optionally, the levels are surrounded by a border (replicated by reflection) so that the pyramid can be passed directly
+ * to cv::calcOpticalFlowPyrLK (see getLevels) with a window of up to 2*border+1 pixels.
+ */
+class ARUCO_EXPORTS ImagePyramid
+{
+public:
+    /**
+     */
+    ImagePyramid();
+    /**Builds the pyramid of the image
+     * @param grey CV_8UC1 image
+     * @param nLevels total number of levels (including the image itself). It is reduced if the images become too small
+     * @param border size of the border around the levels. If 0, level 0 shares the data of grey instead of copying it
+     */
+    void build(const cv::Mat &grey,int nLevels,int border=0)throw(cv::Exception);
+    /**Number of levels available
+     */
+    int size()const{return int(_levels.size());}
+    /**Indicates if the pyramid has not been built
+     */
+    bool empty()const{return _levels.size()==0;}
+    /**Returns the level indicated (without border)
+     */
+    const cv::Mat & operator[](int level)const{return _levels[level];}
+    /**Returns all levels. If they have a border, this vector can be passed to cv::calcOpticalFlowPyrLK
+     */
+    const std::vector<cv::Mat> & getLevels()const{return _levels;}
+    /**Size of the border around the levels
+     */
+    int getBorder()const{return _border;}
+    /**Scale factor of a level with respect to level 0, i.e, 2^level
+     */
+    static float getScale(int level){return float(1<<level);}
+
+private:
+    //levels, as regions of interest of the buffers
+    std::vector<cv::Mat> _levels;
+    //memory of the levels, including the border
+    std::vector<cv::Mat> _buffers;
+    int _border;
+};
+};
+#endif
@@ -53,6 +53,7 @@ Marker::Marker(const Marker &M):std::vector<cv::Point2f>(M)
     M.Rvec.copyTo(Rvec);
     M.Tvec.copyTo(Tvec);
     id=M.id;
+    dictionary=M.dictionary;
     ssize=M.ssize;
 }
 
@@ -250,7 +251,7 @@ void Marker::draw(Mat &in, Scalar color, int lineWidth ,bool writeId)const
 void Marker::calculateExtrinsics(float markerSize,const CameraParameters &CP,bool setYPerpendicular)throw(cv::Exception)
 {
     if (!CP.isValid()) throw cv::Exception(9004,"!CP.isValid(): invalid camera parameters. It is not possible to calculate extrinsics","calculateExtrinsics",__FILE__,__LINE__);
-    calculateExtrinsics( markerSize,CP.CameraMatrix,CP.Distorsion,setYPerpendicular);
+    calculateExtrinsics( markerSize,CP.CameraMatrix,CP.getActiveDistorsion(),setYPerpendicular);
 }
 
 void print(cv::Point3f p,string cad){
@@ -295,7 +296,6 @@ void Marker::calculateExtrinsics(float markerSizeMeters,cv::Mat  camMatrix,cv::M
     //rotate the X axis so that Y is perpendicular to the marker plane
    if (setYPerpendicular) rotateXAxis(Rvec);
     ssize=markerSizeMeters; 
-    cout<<(*this)<<endl;
     
 }
 
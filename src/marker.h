@@ -29,6 +29,7 @@ or implied, of Rafael Muñoz Salinas.
 #define _Aruco_Marker_H
 #include <vector>
 #include <iostream>
+#include <string>
 #include <opencv2/core/core.hpp>
 #include "exports.h"
 #include "cameraparameters.h"
@@ -43,6 +44,8 @@ class  ARUCO_EXPORTS Marker: public std::vector<cv::Point2f>
 public:
     //id of  the marker
     int id;
+    //name of the dictionary the id belongs to (see MarkerDetector::setMarkerDecoders). Empty for the default decoder
+    std::string dictionary;
     //size of the markers sides in meters
     float ssize;
     //matrices of rotation and translation respect to the camera
@@ -114,7 +117,8 @@ public:
      */
     friend bool operator<(const Marker &M1,const Marker&M2)
     {
-        return M1.id<M2.id;
+        if (M1.id!=M2.id) return M1.id<M2.id;
+        return M1.dictionary<M2.dictionary;
     }
     /**
      */
@@ -0,0 +1,236 @@
+/*****************************
+Copyright 2011 Rafael Muñoz Salinas. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY Rafael Muñoz Salinas ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Rafael Muñoz Salinas OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of Rafael Muñoz Salinas.
+********************************/
+#include "markerdecoder.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include "hammingcode.h"
+using namespace std;
+namespace aruco
+{
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+MarkerSample::MarkerSample()
+{
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerSample::setImage(const cv::Mat &canonical)throw(cv::Exception)
+{
+    if (canonical.type()!=CV_8UC1 || canonical.rows!=canonical.cols)
+        throw cv::Exception(9001,"The canonical image must be a square CV_8UC1 image","MarkerSample::setImage",__FILE__,__LINE__);
+    _image=canonical;
+    //computed on demand
+    _sum.release();
+    _whiteSum.release();
+    _cells.clear();
+    _bits.clear();
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+const cv::Mat & MarkerSample::getCells(int gridSize)throw(cv::Exception)
+{
+    if (gridSize<1 || gridSize>_image.rows)
+        throw cv::Exception(9001,"Invalid grid size","MarkerSample::getCells",__FILE__,__LINE__);
+    std::map<int,cv::Mat>::iterator it=_cells.find(gridSize);
+    if (it!=_cells.end()) return it->second;
+    //the integral image is shared by the grids of all sizes
+    if (_sum.empty()) cv::integral(_image,_sum,CV_32S);
+    cv::Mat &cells=_cells[gridSize];
+    cells.create(gridSize,gridSize,CV_32FC1);
+    for (int y=0;y<gridSize;y++)
+    {
+        int y0=y*_image.rows/gridSize,y1=(y+1)*_image.rows/gridSize;
+        const int *top=_sum.ptr<int>(y0),*bottom=_sum.ptr<int>(y1);
+        for (int x=0;x<gridSize;x++)
+        {
+            int x0=x*_image.cols/gridSize,x1=(x+1)*_image.cols/gridSize;
+            cells.at<float>(y,x)=float(bottom[x1]-bottom[x0]-top[x1]+top[x0])/float((x1-x0)*(y1-y0));
+        }
+    }
+    return cells;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+const cv::Mat & MarkerSample::getBits(int gridSize)throw(cv::Exception)
+{
+    std::map<int,cv::Mat>::iterator it=_bits.find(gridSize);
+    if (it!=_bits.end()) return it->second;
+    if (gridSize<1 || gridSize>_image.rows)
+        throw cv::Exception(9001,"Invalid grid size","MarkerSample::getBits",__FILE__,__LINE__);
+    //the number of white pixels of any cell is obtained from the integral of the image thresholded
+    if (_whiteSum.empty())
+    {
+        cv::Mat white;
+        cv::threshold(_image,white,125,1,cv::THRESH_BINARY|cv::THRESH_OTSU);
+        cv::integral(white,_whiteSum,CV_32S);
+    }
+    int swidth=_image.rows/gridSize;
+    cv::Mat &bits=_bits[gridSize];
+    bits.create(gridSize,gridSize,CV_8UC1);
+    for (int y=0;y<gridSize;y++)
+    {
+        const int *top=_whiteSum.ptr<int>(y*swidth),*bottom=_whiteSum.ptr<int>((y+1)*swidth);
+        for (int x=0;x<gridSize;x++)
+        {
+            int x0=x*swidth,x1=(x+1)*swidth;
+            int nZ=bottom[x1]-bottom[x0]-top[x1]+top[x0];
+            bits.at<uchar>(y,x)= nZ> (swidth*swidth) /2?1:0;
+        }
+    }
+    return bits;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+bool MarkerSample::hasBlackBorder(int gridSize)throw(cv::Exception)
+{
+    const cv::Mat &bits=getBits(gridSize);
+    for (int i=0;i<gridSize;i++)
+        if (bits.at<uchar>(0,i)!=0 || bits.at<uchar>(gridSize-1,i)!=0 || bits.at<uchar>(i,0)!=0 || bits.at<uchar>(i,gridSize-1)!=0)
+            return false;
+    return true;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+int ArucoMarkerDecoder::decode(MarkerSample &sample,int &nRotations)
+{
+    //7x7 cells, of which the inner 5x5 belongs to marker info. The external border must be entirely black
+    if (!sample.hasBlackBorder(7)) return -1;
+    cv::Mat inner=sample.getBits(7)(cv::Rect(1,1,5,5)).clone();
+    cv::Mat bits=cv::Mat::zeros(5,5,CV_8UC1);
+    nRotations=nkdhny::HammingCode::rotate(inner,bits);
+    int id=nkdhny::HammingCode::decode(bits);
+    return isAllowed(id)?id:-1;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+HRMDecoder::HRMDecoder(const Dictionary &D,const std::string &name,bool checkBorder)throw(cv::Exception)
+{
+    if (D.size()==0) throw cv::Exception(9001,"Empty dictionary","HRMDecoder::HRMDecoder",__FILE__,__LINE__);
+    _D=D;
+    _name=name;
+    _checkBorder=checkBorder;
+    _n=_D[0].n();
+    _correctionDistance=(unsigned int)floor( (_D.minimunDistance()-1)/2. );
+    _tree.loadDictionary(&_D);
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+int HRMDecoder::decode(MarkerSample &sample,int &nRotations)
+{
+    //the code, surrounded by a black border of one cell
+    int gridSize=_n+2;
+    if (_checkBorder && !sample.hasBlackBorder(gridSize)) return -1;
+    const cv::Mat &bits=sample.getBits(gridSize);
+    MarkerCode candidate(_n);
+    for (unsigned int y=0;y<_n;y++)
+        for (unsigned int x=0;x<_n;x++)
+            if (bits.at<uchar>(y+1,x+1)) candidate.set(y*_n+x,1);
+    //exact match in any rotation. A code out of the allowed set can not be within the correction distance of another one
+    unsigned int orgPos;
+    for (unsigned int i=0;i<4;i++)
+        if (_tree.findId(candidate.getId(i),orgPos)) {
+            if (!isAllowed(candidate.getId(i))) return -1;
+            nRotations=i;
+            return candidate.getId(i);
+        }
+    //correct errors
+    unsigned int minMarker=0,minRot=0,dist;
+    if (_allowedIds.empty()) dist=_D.distance(candidate,minMarker,minRot);
+    else {
+        //only against the allowed codes
+        dist=candidate.size();
+        for (size_t i=0;i<_allowedIdx.size();i++) {
+            unsigned int rot;
+            unsigned int d=_D[_allowedIdx[i]].distance(candidate,rot);
+            if (d<dist) {
+                dist=d;
+                minMarker=_allowedIdx[i];
+                minRot=rot;
+            }
+        }
+    }
+    if (dist<=_correctionDistance) {
+        nRotations=minRot;
+        return _D[minMarker].getId();
+    }
+    return -1;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void HRMDecoder::setAllowedIds(const std::set<int> &ids)
+{
+    _allowedIds=ids;
+    _allowedIdx.clear();
+    for (unsigned int i=0;i<_D.size();i++)
+        if (isAllowed(_D[i].getId())) _allowedIdx.push_back(i);
+}
+
+}
@@ -0,0 +1,178 @@
+/*****************************
+Copyright 2011 Rafael Muñoz Salinas. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY Rafael Muñoz Salinas ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Rafael Muñoz Salinas OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of Rafael Muñoz Salinas.
+********************************/
+#ifndef _Aruco_MarkerDecoder_H
+#define _Aruco_MarkerDecoder_H
+#include <opencv2/core/core.hpp>
+#include <string>
+#include <map>
+#include <set>
+#include "exports.h"
+#include "highlyreliablemarkers.h"
+namespace aruco
+{
+/**\brief Canonical image of a candidate, shared by the decoders tried on it
+ *
+ * The cells of a grid of any size are obtained from integral images computed once (of the image and of the image thresholded),
+ * and the grids already computed are kept until a new image is set. Thus, several decoders working on grids of different
+ * sizes sample the candidate only once.
+ */
+class ARUCO_EXPORTS MarkerSample
+{
+public:
+    /**
+     */
+    MarkerSample();
+    /**Sets the canonical image of a candidate (square, CV_8UC1), forgetting the data of the previous one
+     */
+    void setImage(const cv::Mat &canonical)throw(cv::Exception);
+    /**
+     */
+    const cv::Mat & getImage()const{return _image;}
+    /**Returns the mean intensity of each cell of a grid of gridSize x gridSize cells covering the image (CV_32FC1)
+     */
+    const cv::Mat & getCells(int gridSize)throw(cv::Exception);
+    /**Returns the cells of a grid of gridSize x gridSize cells thresholded (CV_8UC1), 1 for the white cells and 0 for the black ones.
+     * As in FiducidalMarkers::detect and HighlyReliableMarkers::detect, the image is thresholded by Otsu's method, the cells are squares
+     * of rows/gridSize pixels from the top left corner, and a cell is white if more than half of its pixels are
+     */
+    const cv::Mat & getBits(int gridSize)throw(cv::Exception);
+    /**Indicates if all the cells in the border of the grid of getBits(gridSize) are black
+     */
+    bool hasBlackBorder(int gridSize)throw(cv::Exception);
+
+private:
+    cv::Mat _image,_sum;
+    //integral of the image thresholded (1 for the white pixels), empty if not computed yet
+    cv::Mat _whiteSum;
+    std::map<int,cv::Mat> _cells,_bits;
+};
+
+/**\brief Decoder of the markers of a dictionary
+ *
+ * MarkerDetector tries the decoders set with setMarkerDecoders on each candidate, in order, and tags the markers with
+ * the name of the one that identifies them.
+ */
+class ARUCO_EXPORTS MarkerDecoder
+{
+public:
+    virtual ~MarkerDecoder(){}
+    /**Identifies the marker in a canonical image
+     * @param sample canonical image of the candidate
+     * @param nRotations output number of rotations of the marker in the image
+     * @return id of the marker, or -1 if it is not a marker of the dictionary
+     */
+    virtual int decode(MarkerSample &sample,int &nRotations)=0;
+    /**Name of the dictionary, employed to tag the markers
+     */
+    virtual std::string getName()const=0;
+    /**Restricts the ids returned by decode to these in the set (all if empty). The codes out of the set are
+     * rejected as soon as possible, and the error correction only considers the codes in the set
+     */
+    virtual void setAllowedIds(const std::set<int> &ids){_allowedIds=ids;}
+    /**Returns the set of allowed ids (empty if all are allowed)
+     */
+    const std::set<int> & getAllowedIds()const{return _allowedIds;}
+
+protected:
+    bool isAllowed(int id)const{return _allowedIds.empty() || _allowedIds.find(id)!=_allowedIds.end();}
+    std::set<int> _allowedIds;
+};
+
+/**\brief Decoder of the default markers of the library (FiducidalMarkers with HammingCode), 7x7 cells including the border
+ */
+class ARUCO_EXPORTS ArucoMarkerDecoder: public MarkerDecoder
+{
+public:
+    /**
+     */
+    int decode(MarkerSample &sample,int &nRotations);
+    /**
+     */
+    std::string getName()const{return "ARUCO";}
+};
+
+/**\brief Decoder of a dictionary of highly reliable markers (see HighlyReliableMarkers), with error correction.
+ * Unlike HighlyReliableMarkers::detect, each object has its own dictionary, so that several of them can be employed at the same time
+ */
+class ARUCO_EXPORTS HRMDecoder: public MarkerDecoder
+{
+public:
+    /**
+     * @param D dictionary
+     * @param name name of the dictionary
+     * @param checkBorder if true, candidates whose border is not entirely black are rejected. HighlyReliableMarkers::detect does not
+     * check it (a border cell misread is not corrected), so it is disabled by default
+     */
+    HRMDecoder(const Dictionary &D,const std::string &name,bool checkBorder=false)throw(cv::Exception);
+    /**
+     */
+    int decode(MarkerSample &sample,int &nRotations);
+    /**
+     */
+    std::string getName()const{return _name;}
+    /**
+     */
+    void setAllowedIds(const std::set<int> &ids);
+
+private:
+    Dictionary _D;
+    HighlyReliableMarkers::BalancedBinaryTree _tree;
+    unsigned int _n,_correctionDistance;
+    bool _checkBorder;
+    //positions in _D of the allowed codes (if any restriction)
+    std::vector<unsigned int> _allowedIdx;
+    std::string _name;
+};
+
+/**\brief Decoder that calls a function working on the canonical image, such as these employed in MarkerDetector::setMakerDetectorFunction
+ */
+class ARUCO_EXPORTS FunctionMarkerDecoder: public MarkerDecoder
+{
+public:
+    /**
+     * @param func function returning the id of the marker in the image (or -1) and its number of rotations
+     * @param name name of the dictionary
+     */
+    FunctionMarkerDecoder(int (* func)(const cv::Mat &in,int &nRotations),const std::string &name):_func(func),_name(name){}
+    /**
+     */
+    int decode(MarkerSample &sample,int &nRotations){
+        int id=(*_func)(sample.getImage(),nRotations);
+        return isAllowed(id)?id:-1;
+    }
+    /**
+     */
+    std::string getName()const{return _name;}
+
+private:
+    int (* _func)(const cv::Mat &in,int &nRotations);
+    std::string _name;
+};
+
+}
+#endif
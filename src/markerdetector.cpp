@@ -33,12 +33,110 @@ or implied, of Rafael Muñoz Salinas.
 #include <fstream>
 #include "arucofidmarkers.h"
 #include <valarray>
+#include <limits>
 #include "ar_omp.h"
 using namespace std;
 using namespace cv;
+
+//instrumentation of the detection stages. When ARUCO_DETECTION_STATS is not defined, it vanishes
+#ifdef ARUCO_DETECTION_STATS
+#define ARUCO_STATS_TIC(t) int64 t=cv::getTickCount()
+#define ARUCO_STATS_RESTART(t) t=cv::getTickCount()
+#define ARUCO_STATS_TOC(t,field) { int64 _now=cv::getTickCount(); _stats.field+=double(_now-t)*1000./cv::getTickFrequency(); t=_now; }
+#define ARUCO_STATS_ADD(field,n) _stats.field+=(n)
+#define ARUCO_STATS_SET(field,n) _stats.field=(n)
+#else
+#define ARUCO_STATS_TIC(t)
+#define ARUCO_STATS_RESTART(t)
+#define ARUCO_STATS_TOC(t,field)
+#define ARUCO_STATS_ADD(field,n)
+#define ARUCO_STATS_SET(field,n)
+#endif
   
 namespace aruco
 {
+/**Undistortion of the contour pixels in LINES refinement. It employs the precomputed table of the camera parameters
+ * when they are available, and the analytic model otherwise
+ */
+struct LinesUndistorter
+{
+    LinesUndistorter(const cv::Mat &camMatrix,const cv::Mat &distCoeff):model(camMatrix,distCoeff),cp(NULL){}
+    LinesUndistorter(const CameraParameters &camParams):cp(camParams.hasActiveDistorsion()?&camParams:NULL){}
+    bool isValid()const{return cp!=NULL || model.isValid();}
+    cv::Point2f undistort(const cv::Point2f &p)const{return cp!=NULL?cp->undistortPoint(p):model.undistort(p);}
+    cv::Point2f distort(const cv::Point2f &p)const{return cp!=NULL?cp->distortPoint(p):model.distort(p);}
+    DistortionModel model;
+    const CameraParameters *cp;
+};
+
+/**Running sums to fit a line by total least squares. Points are referred to the first one to avoid loss of precision
+ */
+struct LineFitter
+{
+    LineFitter():n(0),sx(0),sy(0),sxx(0),sxy(0),syy(0){}
+    void add(const cv::Point2f &p)
+    {
+        if (n==0) origin=p;
+        double x=p.x-origin.x,y=p.y-origin.y;
+        n++;
+        sx+=x;sy+=y;
+        sxx+=x*x;sxy+=x*y;syy+=y*y;
+    }
+    //line ax+by+c=0 with (a,b) unitary, normal to the direction of maximum variance
+    bool fit(cv::Point3d &line)const
+    {
+        if (n<2) return false;
+        double mx=sx/n,my=sy/n;
+        double cxx=sxx/n-mx*mx,cxy=sxy/n-mx*my,cyy=syy/n-my*my;
+        double theta=0.5*atan2(2*cxy,cxx-cyy);
+        line.x=-sin(theta);
+        line.y=cos(theta);
+        line.z=-(line.x*(mx+origin.x)+line.y*(my+origin.y));
+        return true;
+    }
+    int n;
+    cv::Point2f origin;
+    double sx,sy,sxx,sxy,syy;
+};
+
+static void refineLines(Marker& candidate, const vector<Point> &contour, const LinesUndistorter &undistorter);
+
+//smallest rectangle in an image reduced by scale containing r
+static Rect scaleRect(const Rect &r,float scale)
+{
+    int x0=cvFloor ( r.x/scale ),y0=cvFloor ( r.y/scale );
+    int x1=cvCeil ( ( r.x+r.width ) /scale ),y1=cvCeil ( ( r.y+r.height ) /scale );
+    return Rect ( x0,y0,x1-x0,y1-y0 );
+}
+
+//clips the rectangles to imRect and merges the overlapping ones, so that no pixel is processed twice
+static void mergeRects(vector<Rect> rects,const Rect &imRect,vector<Rect> &out)
+{
+    for ( size_t i=0;i<rects.size();i++ ) rects[i]&=imRect;
+    bool merged=true;
+    while ( merged )
+    {
+        merged=false;
+        for ( size_t i=0;i<rects.size() && !merged;i++ )
+            for ( size_t j=i+1;j<rects.size() && !merged;j++ )
+                if ( ( rects[i]&rects[j] ).area() >0 )
+                {
+                    rects[i]|=rects[j];
+                    rects.erase ( rects.begin()+j );
+                    merged=true;
+                }
+    }
+    out.clear();
+    for ( size_t i=0;i<rects.size();i++ )
+        if ( rects[i].area() >0 ) out.push_back ( rects[i] );
+}
+
+//true if the deadline (in ticks) has passed. A deadline of 0 means no limit
+static inline bool deadlineReached(int64 deadline)
+{
+    return deadline!=0 && cv::getTickCount()>=deadline;
+}
+
 /************************************
  *
  *
@@ -48,6 +146,7 @@ namespace aruco
 MarkerDetector::MarkerDetector()
 {
     _doErosion=false; 
+    _contourMode=CONTOURS_LIST;
     _thresMethod=ADPT_THRES;
     _thresParam1=_thresParam2=7;
     _cornerMethod=LINES;
@@ -59,6 +158,71 @@ MarkerDetector::MarkerDetector()
     _maxSize=0.5;
 
   _borderDistThres=0.01;//corners in a border of 1% of image  are ignored
+    _minSideLength=10;
+    _minArea=0;
+    _maxArea=1;
+    _maxAspectRatio=0;
+    //cheapest tests first
+    _candidateFilters.push_back(FILTER_BORDER);
+    _candidateFilters.push_back(FILTER_MIN_SIDE);
+    _candidateFilters.push_back(FILTER_AREA);
+    _candidateFilters.push_back(FILTER_ASPECT);
+    _candidateFilters.push_back(FILTER_CONVEX);
+    _timeBudget=0;//no limit
+    _candidatePriority=PRIORITY_SIZE;
+    _partialDetection=false;
+    _coarseToFine=true;
+    _autoScale=false;
+    _autoScaleMinPixelsPerBit=2;
+    _autoScaleGridSize=7;
+    _autoScaleMaxLevel=4;
+    _autoScaleMargin=0.5;
+    _autoScaleLevel=0;
+    _observedMinSide=-1;
+    _frameCounter=0;
+    _negCacheEnabled=false;
+    _negCacheTTL=30;
+    _negCacheQuantStep=4;
+    _negCacheReverify=5;
+    _thresWrittenAll=true;
+    _negCacheHits=_negCacheLookups=0;
+    _idCacheEnabled=false;
+    _idCacheInterval=10;
+    _idCacheTolerance=2;
+    _idCacheGridSize=7;
+    _idCacheHits=_idCacheMisses=0;
+    _roiEnabled=false;
+    _gateEnabled=false;
+    _gateBlockSize=16;
+    _gateThreshold=3;
+    _gateMaxPartialFraction=0.5;
+    _gateMarkerSize=-1;
+    _gateSetY=false;
+    _gateLevel=0;
+    _gateFrames=_gateSkipped=_gatePartial=0;
+    _prescreenEnabled=false;
+    _prescreenLevel=3;
+    _prescreenMargin=8;
+    _prescreenInterval=30;
+    _prescreenCounter=0;
+    _tuneEnabled=false;
+    _tuneMinBlock=3;
+    _tuneMaxBlock=31;
+    _tuneMinConst=2;
+    _tuneMaxConst=15;
+    _tunePeriod=5;
+    _tuneBestParam1=_tuneBestParam2=_tuneBestScore=0;
+    _tuneHasScore=false;
+    _tuneDirection=_tuneNextDirection=-1;
+    _tuneFailures=0;
+    _tuneFrames=0;
+    _tuneScoreSum=0;
+    _tuneWait=0;
+    _candidateBudget=0;
+    _govTarget=0;
+    _govLevel=0;
+    _govCallsOver=_govCallsSinceChange=0;
+    updateSpeedSettings();
 }
 /************************************
  *
@@ -81,7 +245,7 @@ MarkerDetector::~MarkerDetector()
 void MarkerDetector::setDesiredSpeed ( int val )
 {
     if ( val<0 ) val=0;
-    else if ( val>3 ) val=2;
+    else if ( val>3 ) val=3;
 
     _speed=val;
     switch ( _speed )
@@ -95,10 +259,12 @@ void MarkerDetector::setDesiredSpeed ( int val )
 
     case 1:
     case 2:
+    case 3:
         _markerWarpSize=28;
         _cornerMethod=NONE;
         break;
     };
+    updateSpeedSettings();
 }
 
 /************************************
@@ -107,26 +273,71 @@ void MarkerDetector::setDesiredSpeed ( int val )
  *
  *
  ************************************/
-void MarkerDetector::detect ( const  cv::Mat &input,std::vector<Marker> &detectedMarkers, CameraParameters camParams ,float markerSizeMeters ,bool setYPerpendicular) throw ( cv::Exception )
+void MarkerDetector::detect ( const  cv::Mat &input,std::vector<Marker> &detectedMarkers,const CameraParameters &camParams ,float markerSizeMeters ,bool setYPerpendicular) throw ( cv::Exception )
 {
-    detect ( input, detectedMarkers,camParams.CameraMatrix ,camParams.Distorsion,  markerSizeMeters ,setYPerpendicular);
+    detect ( input, detectedMarkers,camParams.CameraMatrix ,camParams.getActiveDistorsion(),  markerSizeMeters ,setYPerpendicular,&camParams);
 }
 
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerDetector::detect ( const ImagePyramid &pyramid,std::vector<Marker> &detectedMarkers,const CameraParameters &camParams ,float markerSizeMeters ,bool setYPerpendicular) throw ( cv::Exception )
+{
+    if ( pyramid.empty() ) throw cv::Exception ( 9001,"empty pyramid","MarkerDetector::detect",__FILE__,__LINE__ );
+    detect ( pyramid[0], detectedMarkers,camParams.CameraMatrix ,camParams.getActiveDistorsion(),  markerSizeMeters ,setYPerpendicular,&camParams,&pyramid);
+}
 
 /************************************
  *
- * Main detection function. Performs all steps
+ *
  *
  *
  ************************************/
 void MarkerDetector::detect ( const  cv::Mat &input,vector<Marker> &detectedMarkers,Mat camMatrix ,Mat distCoeff ,float markerSizeMeters ,bool setYPerpendicular) throw ( cv::Exception )
 {
+    detect ( input, detectedMarkers,camMatrix ,distCoeff,  markerSizeMeters ,setYPerpendicular,NULL);
+}
+
 
+/************************************
+ *
+ * Main detection function. Performs all steps
+ *
+ *
+ ************************************/
+void MarkerDetector::detect ( const  cv::Mat &input,vector<Marker> &detectedMarkers,const Mat &camMatrix ,const Mat &distCoeff ,float markerSizeMeters ,bool setYPerpendicular,const CameraParameters *camParams,const ImagePyramid *pyramid) throw ( cv::Exception )
+{
+    _stats.reset();
+    int64 govStartTick=cv::getTickCount();
+    //deadline of the detection if a time budget is set
+    int64 deadline= _timeBudget>0 ? cv::getTickCount() +int64 ( _timeBudget*cv::getTickFrequency() /1000. ) :0;
+    _partialDetection=false;
+    _skippedCandidates.clear();
+    _frameCounter++;
+    ARUCO_STATS_TIC(startTick);
+    ARUCO_STATS_TIC(tick);
 
     //it must be a 3 channel image
     if ( input.type() ==CV_8UC3 )   cv::cvtColor ( input,grey,CV_BGR2GRAY );
     else     grey=input;
+    ARUCO_STATS_TOC(tick,tGrey);
 
+    //has the image changed since the last frame processed?
+    vector<Rect> changedRegions;
+    FrameChange change=FRAME_CHANGED;
+    if ( _gateEnabled )
+    {
+        change=checkFrameChange ( grey,camMatrix,markerSizeMeters,setYPerpendicular,changedRegions );
+        if ( change==FRAME_UNCHANGED )
+        {
+            detectedMarkers=_gateMarkers;
+            ARUCO_STATS_TOC(startTick,tTotal);
+            return;
+        }
+    }
 
 //     cv::cvtColor(grey,_ssImC ,CV_GRAY2BGR); //DELETE
 
@@ -136,38 +347,156 @@ void MarkerDetector::detect ( const  cv::Mat &input,vector<Marker> &detectedMark
 
     cv::Mat imgToBeThresHolded=grey;
     double ThresParam1=_thresParam1,ThresParam2=_thresParam2;
+    //several pairs of threshold parameters?
+    bool multiThres= !_thresParamsList.empty() && ( _thresMethod==FIXED_THRES || _thresMethod==ADPT_THRES );
+    vector<std::pair<double,double> > thresParamsList;
+    if ( multiThres ) thresParamsList=_thresParamsList;
+    //the pyramid given or, if it has not enough levels, the internal one. Its memory is kept between calls,
+    //and each level is computed once
+    //(the speed governor adds its levels of reduction to the one selected)
+    int wantedLevel= _autoScale ? std::min ( selectAutoScaleLevel ( grey.size() ) +_activeSpeed.pyrDownLevel-pyrdown_level,_autoScaleMaxLevel ) :_activeSpeed.pyrDownLevel;
+    const ImagePyramid *pyr=pyramid;
+    if ( pyr==NULL || pyr->size() <=wantedLevel )
+    {
+        //with the level of the thumbnail of the pre-screening, if any
+        _pyramid.build ( grey,std::max ( wantedLevel,_prescreenEnabled?_prescreenLevel:0 ) +1 );
+        pyr=&_pyramid;
+    }
+    //level employed for detection (might be lower than the one wanted if the image is too small)
+    int level=std::min ( wantedLevel,pyr->size()-1 );
+    _autoScaleLevel=level;
+    //with automatic selection of the level, the window covers about two cells of the smallest marker expected (at any level)
+    bool autoWindow= _autoScale && _thresMethod==ADPT_THRES;
+    if ( autoWindow )
+        ThresParam1=std::max ( 3,2*cvRound ( expectedPixelsPerBit ( grey.size() ) /ImagePyramid::getScale ( level ) ) +1 );
     //Must the image be downsampled before continue pocessing?
-    if ( pyrdown_level!=0 )
+    if ( level!=0 )
     {
-        reduced=grey;
-        for ( int i=0;i<pyrdown_level;i++ )
+        reduced= ( *pyr ) [level];
+        float red_den=ImagePyramid::getScale ( level );
+        imgToBeThresHolded=reduced;
+        if ( !autoWindow )
         {
-            cv::Mat tmp;
-            cv::pyrDown ( reduced,tmp );
-            reduced=tmp;
+            ThresParam1/=red_den;
+            ThresParam2/=red_den;
+        }
+        for ( size_t i=0;i<thresParamsList.size();i++ )
+        {
+            thresParamsList[i].first/=red_den;
+            thresParamsList[i].second/=red_den;
         }
-        int red_den=pow ( 2.0f,pyrdown_level );
-        imgToBeThresHolded=reduced;
-        ThresParam1/=float ( red_den );
-        ThresParam2/=float ( red_den );
     }
+    ARUCO_STATS_TOC(tick,tPyramid);
 
+    //the thresholded image of the last frame can only be reused if obtained at the same level, and if it is the only one
+    if ( change==FRAME_PARTIAL && ( multiThres || level!=_gateLevel || thres.size() !=imgToBeThresHolded.size() ) )
+    {
+        change=FRAME_CHANGED;
+        _gateCurrent.copyTo ( _gateDigest );
+    }
+    //pre-screening in a thumbnail: frames without quads are not processed further, and the rest only in the regions of the quads
+    bool prescreened=false;
+    _prescreenRegions.clear();
+    if ( _prescreenEnabled && change==FRAME_CHANGED && !_roiEnabled )
+    {
+        int thumbLevel=std::min ( _prescreenLevel,pyr->size()-1 );
+        if ( thumbLevel>level && ( _prescreenInterval==0 || ++_prescreenCounter<_prescreenInterval ) )
+        {
+            prescreen ( ( *pyr ) [thumbLevel],ImagePyramid::getScale ( thumbLevel ),grey.size(),_prescreenRegions );
+            ARUCO_STATS_SET(nPrescreenRegions,int ( _prescreenRegions.size() ));
+            prescreened=true;
+        }
+        else _prescreenCounter=0;
+    }
+    ARUCO_STATS_TOC(tick,tPrescreen);
+    //no quads in the thumbnail and no markers in the last call: there is nothing to process
+    if ( prescreened && _prescreenRegions.empty() && _prescreenMarkerRects.empty() )
+    {
+        vector<Rect> noRegions;
+        resetThresholded ( thres,imgToBeThresHolded.size(),&noRegions );
+        _candidates.clear();
+        if ( _idCacheEnabled ) _idCache.clear();
+        if ( _gateEnabled )
+        {
+            _gateMarkers.clear();
+            _gateLevel=level;
+        }
+        _observedMinSide=-1;
+        _prevMarkerCenters.clear();
+        if ( _govTarget>0 )
+            updateSpeedGovernor ( double ( cv::getTickCount()-govStartTick ) *1000./cv::getTickFrequency() );
+        ARUCO_STATS_TOC(startTick,tTotal);
+        return;
+    }
     ///Do threshold the image and detect contours
-    thresHold ( _thresMethod,imgToBeThresHolded,thres,ThresParam1,ThresParam2 );
-    //an erosion might be required to detect chessboard like boards
-    if ( _doErosion )
+    const RoiLevel *roi=NULL;
+    RoiLevel changedRoi;
+    if ( change==FRAME_PARTIAL )
+    {
+        //only the regions that changed
+        vector<Rect> levelRects;
+        for ( size_t i=0;i<changedRegions.size();i++ )
+            levelRects.push_back ( scaleRect ( changedRegions[i],ImagePyramid::getScale ( level ) ) );
+        changedRoi.imSize=imgToBeThresHolded.size();
+        mergeRects ( levelRects,Rect ( 0,0,imgToBeThresHolded.cols,imgToBeThresHolded.rows ),changedRoi.rects );
+        roi=&changedRoi;
+    }
+    else if ( _roiEnabled )
+    {
+        if ( !_roiMask.empty() && _roiMask.size() !=grey.size() )
+            throw cv::Exception ( 9001,"The size of the mask does not match the size of the image","MarkerDetector::detect",__FILE__,__LINE__ );
+        roi=&getRoiLevel ( level,imgToBeThresHolded.size() );
+    }
+    else if ( prescreened )
     {
-        erode ( thres,thres2,cv::Mat() );
-        thres2.copyTo(thres); //vs thres=thres2;
+        //the regions found and these of the last markers, which might be too small in the thumbnail
+        vector<Rect> levelRects;
+        for ( size_t i=0;i<_prescreenRegions.size();i++ )
+            levelRects.push_back ( scaleRect ( _prescreenRegions[i],ImagePyramid::getScale ( level ) ) );
+        for ( size_t i=0;i<_prescreenMarkerRects.size();i++ )
+            levelRects.push_back ( scaleRect ( _prescreenMarkerRects[i],ImagePyramid::getScale ( level ) ) );
+        changedRoi.imSize=imgToBeThresHolded.size();
+        mergeRects ( levelRects,Rect ( 0,0,imgToBeThresHolded.cols,imgToBeThresHolded.rows ),changedRoi.rects );
+        roi=&changedRoi;
     }
-    //find all rectangles in the thresholdes image
     vector<MarkerCandidate > MarkerCanditates;
-    detectRectangles ( thres,MarkerCanditates );
+    if ( multiThres )
+    {
+        //thresholds, erosion and rectangles of all the pairs of parameters
+        detectRectanglesMulti ( imgToBeThresHolded,thresParamsList,roi,MarkerCanditates );
+    }
+    else
+    {
+        if ( roi!=NULL )
+        {
+            //only in the regions of interest (erosion included). If processing the changes of the last frame, the rest
+            //of the thresholded image is kept
+            thresHoldROI ( *roi,imgToBeThresHolded,thres,ThresParam1,ThresParam2,change!=FRAME_PARTIAL );
+            ARUCO_STATS_TOC(tick,tThreshold);
+        }
+        else
+        {
+            resetThresholded ( thres,imgToBeThresHolded.size(),NULL );
+            thresHold ( _thresMethod,imgToBeThresHolded,thres,ThresParam1,ThresParam2 );
+            ARUCO_STATS_TOC(tick,tThreshold);
+            //an erosion might be required to detect chessboard like boards. Not with edges, that are one pixel wide
+            if ( _doErosion && _thresMethod!=EDGE_SEGMENTS )
+            {
+                erode ( thres,thres2,cv::Mat() );
+                thres2.copyTo(thres); //vs thres=thres2;
+            }
+        }
+        ARUCO_STATS_TOC(tick,tErosion);
+        //find all rectangles in the thresholdes image
+        if ( _thresMethod==EDGE_SEGMENTS ) detectSegmentQuads ( imgToBeThresHolded,thres,MarkerCanditates,roi!=NULL?&roi->rects:NULL );
+        else detectRectangles ( thres,MarkerCanditates,roi!=NULL?&roi->rects:NULL );
+    }
+    ARUCO_STATS_RESTART(tick);
     //if the image has been downsampled, then calcualte the location of the corners in the original image
-    if ( pyrdown_level!=0 )
+    if ( level!=0 )
     {
-        float red_den=pow ( 2.0f,pyrdown_level );
-        float offInc= ( ( pyrdown_level/2. )-0.5 );
+        float red_den=ImagePyramid::getScale ( level );
+        float offInc= ( ( level/2. )-0.5 );
         for ( unsigned int i=0;i<MarkerCanditates.size();i++ ) {
             for ( int c=0;c<4;c++ )
             {
@@ -182,86 +511,223 @@ void MarkerDetector::detect ( const  cv::Mat &input,vector<Marker> &detectedMark
             }
         }
     }
+    //with a time or candidate budget, the most promising candidates are analyzed first
+    if ( deadline!=0 || _activeSpeed.candidateBudget>0 ) sortCandidatesByPriority ( MarkerCanditates,grey );
+    ARUCO_STATS_TOC(tick,tQuadFilter);
+    ARUCO_STATS_ADD(nCandidates,MarkerCanditates.size());
 
     
     ///identify the markers
-    vector<vector<Marker> >markers_omp(omp_get_max_threads());
+    //identified candidates keep their contour until the LINES refinement is done
+    vector<MarkerCandidate> identified;
+    vector<int> identifiedRotations;
     vector<vector < std::vector<cv::Point2f> > >candidates_omp(omp_get_max_threads());
+    //forget the rejected candidates whose time is over
+    if ( _negCacheEnabled )
+        for ( std::map<uint64,NegativeCacheEntry>::iterator it=_negCache.begin();it!=_negCache.end(); )
+        {
+            if ( it->second.expires<_frameCounter ) _negCache.erase ( it++ );
+            else ++it;
+        }
+    //entries of the cache of identified markers for the next call, and the current entries whose candidate is analyzed in this call
+    vector<IdentityCacheEntry> newIdCache;
+    vector<char> idCacheAnalyzed ( _idCache.size(),0 );
     //#pragma omp parallel for
     for ( unsigned int i=0;i<MarkerCanditates.size();i++ )
     {
+        //out of time or candidates? the rest of candidates are skipped
+        if ( deadlineReached ( deadline ) || ( _activeSpeed.candidateBudget>0 && int ( i ) >=_activeSpeed.candidateBudget ) )
+        {
+            _partialDetection=true;
+            _skippedCandidates.assign ( MarkerCanditates.begin()+i,MarkerCanditates.end() );
+            break;
+        }
+        //was it identified in the previous call? then, if not verified for long, its id is kept
+        if ( _idCacheEnabled )
+        {
+            int nRotations;
+            int entry=findInIdentityCache ( MarkerCanditates[i],nRotations );
+            //replaced by the result of this call (a new entry or none)
+            if ( entry!=-1 ) idCacheAnalyzed[entry]=1;
+            if ( entry!=-1 && _frameCounter-_idCache[entry].lastVerified<_idCacheInterval && checkMarkerBorder ( MarkerCanditates[i],grey ) )
+            {
+                _idCacheHits++;
+                ARUCO_STATS_ADD(nIdentityCacheHits,1);
+                identified.push_back ( MarkerCanditates[i] );
+                identified.back().id=_idCache[entry].id;
+                identified.back().dictionary=_idCache[entry].dictionary;
+                identifiedRotations.push_back ( nRotations );
+                newIdCache.push_back ( _idCache[entry] );
+                newIdCache.back().corners=MarkerCanditates[i];
+                newIdCache.back().nRotations=nRotations;
+                continue;
+            }
+            _idCacheMisses++;
+        }
+        //was it rejected recently?
+        uint64 negKey=0;
+        if ( _negCacheEnabled )
+        {
+            int startCorner;
+            negKey=candidateKey ( MarkerCanditates[i],grey,_negCacheQuantStep,startCorner );
+            _negCacheLookups++;
+            std::map<uint64,NegativeCacheEntry>::iterator neg=_negCache.find ( negKey );
+            //decoded again from time to time, in case it was a marker not identified because of blur, noise...
+            if ( neg!=_negCache.end() && _frameCounter-neg->second.lastVerified<_negCacheReverify )
+            {
+                _negCacheHits++;
+                ARUCO_STATS_ADD(nNegativeCacheHits,1);
+                candidates_omp[omp_get_thread_num()].push_back ( MarkerCanditates[i] );
+                continue;
+            }
+        }
         //Find proyective homography
         Mat canonicalMarker;
         bool resW=false;
-     	resW=warp ( grey,canonicalMarker,Size ( _markerWarpSize,_markerWarpSize ),MarkerCanditates[i] );
+     	resW=warp ( grey,canonicalMarker,Size ( _activeSpeed.warpSize,_activeSpeed.warpSize ),MarkerCanditates[i] );
         if (resW) {
              int nRotations;
-            int id= ( *markerIdDetector_ptrfunc ) ( canonicalMarker,nRotations );
+            ARUCO_STATS_ADD(nDecodeAttempts,1);
+            int id=-1;
+            std::string dictionary;
+            if ( _decoders.empty() )
+            {
+                id= ( *markerIdDetector_ptrfunc ) ( canonicalMarker,nRotations );
+                if ( !_allowedIds.empty() && _allowedIds.find ( id ) ==_allowedIds.end() ) id=-1;
+            }
+            else
+            {
+                //sampled once, the cells are shared by all the decoders
+                _sample.setImage ( canonicalMarker );
+                for ( size_t d=0;d<_decoders.size() && id==-1;d++ )
+                {
+                    nRotations=-1;
+                    id=_decoders[d]->decode ( _sample,nRotations );
+                    if ( id!=-1 && nRotations!=-1 ) dictionary=_decoders[d]->getName();
+                    else id=-1;
+                }
+            }
             if ( id!=-1 && nRotations != -1)
             {
- 		if(_cornerMethod==LINES) // make LINES refinement before lose contour points
-		  refineCandidateLines( MarkerCanditates[i], camMatrix, distCoeff ); 
-                markers_omp[omp_get_thread_num()].push_back ( MarkerCanditates[i] );
-                markers_omp[omp_get_thread_num()].back().id=id;
-                //sort the points so that they are always in the same order no matter the camera orientation
-                std::rotate ( markers_omp[omp_get_thread_num()].back().begin(),markers_omp[omp_get_thread_num()].back().begin() +4-nRotations,markers_omp[omp_get_thread_num()].back().end() );
-
+                ARUCO_STATS_ADD(nDecoded,1);
+                if ( _negCacheEnabled ) _negCache.erase ( negKey );
+                identified.push_back ( MarkerCanditates[i] );
+                identified.back().id=id;
+                identified.back().dictionary=dictionary;
+                identifiedRotations.push_back ( nRotations );
+                if ( _idCacheEnabled )
+                {
+                    newIdCache.push_back ( IdentityCacheEntry() );
+                    newIdCache.back().corners=MarkerCanditates[i];
+                    newIdCache.back().id=id;
+                    newIdCache.back().dictionary=dictionary;
+                    newIdCache.back().nRotations=nRotations;
+                    newIdCache.back().lastVerified=_frameCounter;
+                }
+            }
+            else
+            {
+                candidates_omp[omp_get_thread_num()].push_back ( MarkerCanditates[i] );
+                if ( _negCacheEnabled )
+                {
+                    _negCache[negKey].expires=_frameCounter+_negCacheTTL;
+                    _negCache[negKey].lastVerified=_frameCounter;
+                }
             }
-            else candidates_omp[omp_get_thread_num()].push_back ( MarkerCanditates[i] );
         }
        
     }
+    //the markers not analyzed because of the time budget are kept in the cache (they might be in the next call)
+    if ( _idCacheEnabled )
+    {
+        if ( _partialDetection )
+            for ( size_t e=0;e<_idCache.size();e++ )
+                if ( !idCacheAnalyzed[e] ) newIdCache.push_back ( _idCache[e] );
+        _idCache.swap ( newIdCache );
+    }
+    //the candidates of the last frame out of the regions processed are kept
+    vector<vector<Point2f> > keptCandidates;
+    if ( change==FRAME_PARTIAL )
+        for ( size_t i=0;i<_candidates.size();i++ )
+        {
+            Rect box=boundingRect ( _candidates[i] );
+            bool crosses=false;
+            for ( size_t r=0;r<changedRegions.size() && !crosses;r++ )
+                crosses= ( box&changedRegions[r] ).area() >0;
+            if ( !crosses ) keptCandidates.push_back ( _candidates[i] );
+        }
     //unify parallel data 
-	joinVectors(markers_omp,detectedMarkers,true);
 	joinVectors(candidates_omp,_candidates,true);
+    _candidates.insert ( _candidates.end(),keptCandidates.begin(),keptCandidates.end() );
+    ARUCO_STATS_TOC(tick,tWarpDecode);
 
+    // make LINES refinement before lose contour points. Each marker is refined independently
+    if ( _activeSpeed.cornerMethod==LINES )
+    {
+        LinesUndistorter undistorter= camParams!=NULL? LinesUndistorter ( *camParams ) : LinesUndistorter ( camMatrix,distCoeff );
+        vector<char> notRefined ( identified.size(),0 );
+        #pragma omp parallel for
+        for ( int i=0;i<int ( identified.size() );i++ )
+        {
+            if ( deadlineReached ( deadline ) ) notRefined[i]=1;
+            else refineLines ( identified[i],identified[i].contour,undistorter );
+        }
+        if ( std::count ( notRefined.begin(),notRefined.end(),1 ) >0 ) _partialDetection=true;
+    }
+    detectedMarkers.clear();
+    detectedMarkers.reserve ( identified.size() );
+    for ( size_t i=0;i<identified.size();i++ )
+    {
+        detectedMarkers.push_back ( identified[i] );
+        //sort the points so that they are always in the same order no matter the camera orientation
+        std::rotate ( detectedMarkers.back().begin(),detectedMarkers.back().begin() +4-identifiedRotations[i],detectedMarkers.back().end() );
+    }
 
-
-    ///refine the corner location if desired
-    if ( detectedMarkers.size() >0 && _cornerMethod!=NONE && _cornerMethod!=LINES )
+    ///refine the corner location if desired (and if there is time left)
+    if ( detectedMarkers.size() >0 && _activeSpeed.cornerMethod!=NONE && _activeSpeed.cornerMethod!=LINES && deadlineReached ( deadline ) )
+        _partialDetection=true;
+    else if ( detectedMarkers.size() >0 && _activeSpeed.cornerMethod!=NONE && _activeSpeed.cornerMethod!=LINES )
     {
         vector<Point2f> Corners;
         for ( unsigned int i=0;i<detectedMarkers.size();i++ )
             for ( int c=0;c<4;c++ )
                 Corners.push_back ( detectedMarkers[i][c] );
 
-        if ( _cornerMethod==HARRIS )
-            findBestCornerInRegion_harris ( grey, Corners,7 );
-        else if ( _cornerMethod==SUBPIX )
-            cornerSubPix ( grey, Corners,cvSize ( 5,5 ), cvSize ( -1,-1 )   ,cvTermCriteria ( CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,3,0.05 ) );
+        if ( _activeSpeed.cornerMethod==HARRIS )
+            findBestCornerInRegion_harris ( grey, Corners,7 );//parallelized internally
+        else if ( _activeSpeed.cornerMethod==SUBPIX )
+        {
+            //corners found in a reduced image may be too far from the true location for the small window employed.
+            //So, they are refined first in the intermediate levels of the pyramid (coarse to fine)
+            if ( _coarseToFine )
+                for ( int l=level-1;l>0;l-- )
+                    cornerSubPixParallel ( ( *pyr ) [l],Corners,ImagePyramid::getScale ( l ) );
+            cornerSubPixParallel ( grey,Corners,1 );
+        }
 
         //copy back
         for ( unsigned int i=0;i<detectedMarkers.size();i++ )
             for ( int c=0;c<4;c++ )     detectedMarkers[i][c]=Corners[i*4+c];
     }
-    //sort by id
+    ARUCO_STATS_TOC(tick,tRefinement);
+    //sort by id (and dictionary)
     std::sort ( detectedMarkers.begin(),detectedMarkers.end() );
     //there might be still the case that a marker is detected twice because of the double border indicated earlier,
-    //detect and remove these cases
-    int borderDistThresX=_borderDistThres*float(input.cols);
-    int borderDistThresY=_borderDistThres*float(input.rows);
+    //detect and remove these cases. (Markers too near to the image border are already rejected by FILTER_BORDER)
     vector<bool> toRemove ( detectedMarkers.size(),false );
     for ( int i=0;i<int ( detectedMarkers.size() )-1;i++ )
     {
-        if ( detectedMarkers[i].id==detectedMarkers[i+1].id && !toRemove[i+1] )
+        if ( detectedMarkers[i].id==detectedMarkers[i+1].id && detectedMarkers[i].dictionary==detectedMarkers[i+1].dictionary && !toRemove[i+1] )
         {
             //deletes the one with smaller perimeter
             if ( perimeter ( detectedMarkers[i] ) >perimeter ( detectedMarkers[i+1] ) ) toRemove[i+1]=true;
             else toRemove[i]=true;
         }
-        //delete if any of the corners is too near image border
-        for(size_t c=0;c<detectedMarkers[i].size();c++){
-	    if ( detectedMarkers[i][c].x<borderDistThresX ||
-	      detectedMarkers[i][c].y<borderDistThresY || 
-	      detectedMarkers[i][c].x>input.cols-borderDistThresX ||
-	      detectedMarkers[i][c].y>input.rows-borderDistThresY ) toRemove[i]=true;
-
-	}
- 
-        
     }
     //remove the markers marker
+    ARUCO_STATS_ADD(nDuplicatesRemoved,std::count(toRemove.begin(),toRemove.end(),true));
     removeElements ( detectedMarkers, toRemove );
+    ARUCO_STATS_TOC(tick,tDuplicates);
 
     ///detect the position of detected markers if desired
     if ( camMatrix.rows!=0  && markerSizeMeters>0 )
@@ -269,121 +735,1226 @@ void MarkerDetector::detect ( const  cv::Mat &input,vector<Marker> &detectedMark
         for ( unsigned int i=0;i<detectedMarkers.size();i++ )
             detectedMarkers[i].calculateExtrinsics ( markerSizeMeters,camMatrix,distCoeff,setYPerpendicular );
     }
+    ARUCO_STATS_TOC(tick,tPose);
+    if ( change==FRAME_PARTIAL )
+    {
+        //the markers of the last frame out of the regions processed are kept
+        for ( size_t i=0;i<_gateMarkers.size();i++ )
+        {
+            Rect box=boundingRect ( _gateMarkers[i] );
+            bool crosses=false;
+            for ( size_t r=0;r<changedRegions.size() && !crosses;r++ )
+                crosses= ( box&changedRegions[r] ).area() >0;
+            if ( !crosses ) detectedMarkers.push_back ( _gateMarkers[i] );
+        }
+        std::sort ( detectedMarkers.begin(),detectedMarkers.end() );
+    }
+    if ( _gateEnabled )
+    {
+        //an incomplete result can not be reused, so that the next frame is fully processed
+        if ( _partialDetection ) resetChangeGate();
+        else
+        {
+            _gateMarkers=detectedMarkers;
+            _gateLevel=level;
+        }
+    }
+    //the regions of the markers are always processed in the next pre-screened call
+    if ( _prescreenEnabled )
+    {
+        _prescreenMarkerRects.clear();
+        for ( unsigned int i=0;i<detectedMarkers.size();i++ )
+        {
+            Rect box=boundingRect ( detectedMarkers[i] );
+            _prescreenMarkerRects.push_back ( Rect ( box.x-_prescreenMargin,box.y-_prescreenMargin,box.width+2*_prescreenMargin,box.height+2*_prescreenMargin ) );
+        }
+    }
+    //the smallest marker observed guides the selection of the level in the next call
+    _observedMinSide=-1;
+    for ( unsigned int i=0;i<detectedMarkers.size();i++ )
+        for ( int c=0;c<4;c++ )
+        {
+            float side=norm ( detectedMarkers[i][c]-detectedMarkers[i][ ( c+1 ) %4] );
+            if ( _observedMinSide<0 || side<_observedMinSide ) _observedMinSide=side;
+        }
+    //only the calls that processed the whole image tell how good the threshold parameters are
+    if ( _tuneEnabled && _thresMethod==ADPT_THRES && !multiThres && change==FRAME_CHANGED && !prescreened && !_partialDetection )
+        updateThresholdTuning ( int ( detectedMarkers.size() ),int ( MarkerCanditates.size()-identified.size() ) );
+    if ( _govTarget>0 )
+        updateSpeedGovernor ( double ( cv::getTickCount()-govStartTick ) *1000./cv::getTickFrequency() );
+    //keep the location of the markers for the next call
+    _prevMarkerCenters.resize ( detectedMarkers.size() );
+    for ( unsigned int i=0;i<detectedMarkers.size();i++ )
+        _prevMarkerCenters[i]=detectedMarkers[i].getCenter();
+    ARUCO_STATS_TOC(startTick,tTotal);
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+const MarkerDetector::RoiLevel & MarkerDetector::getRoiLevel ( int level,cv::Size levelSize )
+{
+    if ( int ( _roiLevels.size() ) <=level ) _roiLevels.resize ( level+1 );
+    RoiLevel &roi=_roiLevels[level];
+    if ( roi.imSize==levelSize ) return roi;//already computed
+    roi.imSize=levelSize;
+    roi.rects.clear();
+    roi.rowSpans.clear();
+    Rect imRect ( 0,0,levelSize.width,levelSize.height );
+    float scale=ImagePyramid::getScale ( level );
+    vector<Rect> rects;
+    if ( !_roiMask.empty() )
+    {
+        //the mask is reduced so that a pixel is active if any of the pixels it comes from is active
+        Mat levelMask;
+        if ( level==0 ) levelMask= _roiMask!=0;
+        else
+        {
+            cv::resize ( _roiMask!=0,levelMask,levelSize,0,0,INTER_AREA );
+            levelMask= levelMask!=0;
+        }
+        //spans of active pixels of each row
+        roi.rowSpans.resize ( levelSize.height );
+        for ( int y=0;y<levelSize.height;y++ )
+        {
+            const uchar *row=levelMask.ptr<uchar> ( y );
+            for ( int x=0;x<levelSize.width; )
+            {
+                if ( row[x]==0 ) {x++;continue;}
+                int start=x;
+                while ( x<levelSize.width && row[x]!=0 ) x++;
+                roi.rowSpans[y].push_back ( Vec2i ( start,x ) );
+            }
+        }
+        //bounding rectangles of the regions
+        vector<vector<Point> > contours;
+        vector<Vec4i> hierarchy;
+        cv::findContours ( levelMask,contours,hierarchy,CV_RETR_EXTERNAL,CV_CHAIN_APPROX_SIMPLE );
+        for ( size_t i=0;i<contours.size();i++ ) rects.push_back ( boundingRect ( contours[i] ) );
+    }
+    else
+    {
+        //smallest rectangles at the level containing the original ones
+        for ( size_t i=0;i<_roiRects.size();i++ )
+            rects.push_back ( scaleRect ( _roiRects[i],scale ) );
+    }
+    mergeRects ( rects,imRect,roi.rects );
+    return roi;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerDetector::prescreen ( const cv::Mat &thumb,float scale,cv::Size imSize,std::vector<cv::Rect> &regions )
+{
+    //coarse threshold, with a window of the size of a few cells of the smallest markers the thumbnail can show
+    cv::adaptiveThreshold ( thumb,_prescreenThres,255,ADAPTIVE_THRESH_MEAN_C,THRESH_BINARY_INV,5,5 );
+    std::vector<std::vector<cv::Point> > contours;
+    std::vector<cv::Vec4i> hierarchy;
+    cv::findContours ( _prescreenThres,contours,hierarchy,CV_RETR_LIST,CV_CHAIN_APPROX_NONE );
+    //the size limits are relaxed, the thumbnail loses the details of the contours
+    unsigned int minSize=std::max ( 8,int ( 0.5*_minSize*std::max ( thumb.cols,thumb.rows ) *4 ) );
+    unsigned int maxSize=_maxSize*std::max ( thumb.cols,thumb.rows ) *4;
+    vector<Rect> rects;
+    vector<Point> approxCurve;
+    for ( size_t i=0;i<contours.size();i++ )
+    {
+        if ( contours[i].size() <minSize || contours[i].size() >maxSize ) continue;
+        approxPolyDP ( contours[i],approxCurve,double ( contours[i].size() ) *0.05,true );
+        if ( approxCurve.size() !=4 || !isContourConvex ( Mat ( approxCurve ) ) ) continue;
+        //to the input image
+        Rect box=boundingRect ( approxCurve );
+        int x0=cvFloor ( box.x*scale )-_prescreenMargin,y0=cvFloor ( box.y*scale )-_prescreenMargin;
+        int x1=cvCeil ( ( box.x+box.width ) *scale )+_prescreenMargin,y1=cvCeil ( ( box.y+box.height ) *scale )+_prescreenMargin;
+        rects.push_back ( Rect ( x0,y0,x1-x0,y1-y0 ) );
+    }
+    mergeRects ( rects,Rect ( 0,0,imSize.width,imSize.height ),regions );
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+MarkerDetector::FrameChange MarkerDetector::checkFrameChange ( const cv::Mat &grey,const cv::Mat &camMatrix,float markerSizeMeters,bool setYPerpendicular,std::vector<cv::Rect> &changedRegions )
+{
+    _gateFrames++;
+    //mean of each block
+    Size digestSize ( ( grey.cols+_gateBlockSize-1 ) /_gateBlockSize, ( grey.rows+_gateBlockSize-1 ) /_gateBlockSize );
+    cv::resize ( grey,_gateCurrent,digestSize,0,0,INTER_AREA );
+    //the results of the last frame can only be reused if obtained in the same conditions
+    //(the values of the camera matrix are compared, since its data might be reused by the caller for another matrix)
+    bool sameCamera= _gateCamMatrix.size() ==camMatrix.size() && _gateCamMatrix.type() ==camMatrix.type() &&
+                     ( camMatrix.empty() || cv::norm ( _gateCamMatrix,camMatrix,NORM_INF ) ==0 );
+    bool sameConditions= _gateDigest.size() ==digestSize && _gateMarkerSize==markerSizeMeters && _gateSetY==setYPerpendicular && sameCamera;
+    _gateMarkerSize=markerSizeMeters;
+    _gateSetY=setYPerpendicular;
+    if ( !sameCamera ) camMatrix.copyTo ( _gateCamMatrix );
+    if ( !sameConditions )
+    {
+        _gateCurrent.copyTo ( _gateDigest );
+        return FRAME_CHANGED;
+    }
+    //changed blocks (tiles), enlarged by one block in each direction
+    float sx=float ( grey.cols ) /float ( digestSize.width ),sy=float ( grey.rows ) /float ( digestSize.height );
+    vector<Rect> blocks;
+    for ( int y=0;y<digestSize.height;y++ )
+    {
+        const uchar *cur=_gateCurrent.ptr<uchar> ( y );
+        uchar *ref=_gateDigest.ptr<uchar> ( y );
+        for ( int x=0;x<digestSize.width;x++ )
+            if ( std::abs ( int ( cur[x] )-int ( ref[x] ) ) >_gateThreshold )
+            {
+                blocks.push_back ( Rect ( cvFloor ( ( x-1 ) *sx ),cvFloor ( ( y-1 ) *sy ),cvCeil ( 3*sx ),cvCeil ( 3*sy ) ) );
+                ref[x]=cur[x];//it will be processed
+            }
+    }
+    ARUCO_STATS_ADD(nDirtyTiles,blocks.size());
+    if ( blocks.size() ==0 )
+    {
+        _gateSkipped++;
+        return FRAME_UNCHANGED;
+    }
+    //too many changes to process them separately (regions of interest can not be combined with partial processing)
+    if ( blocks.size() >_gateMaxPartialFraction*digestSize.area() || _roiEnabled )
+    {
+        _gateCurrent.copyTo ( _gateDigest );
+        return FRAME_CHANGED;
+    }
+    //the markers and candidates of the last frame crossing the changed regions are included in them, so that they are processed entirely
+    Rect imRect ( 0,0,grey.cols,grey.rows );
+    vector<Rect> boxes;
+    for ( size_t i=0;i<_gateMarkers.size();i++ ) boxes.push_back ( boundingRect ( _gateMarkers[i] ) );
+    for ( size_t i=0;i<_candidates.size();i++ ) boxes.push_back ( boundingRect ( _candidates[i] ) );
+    mergeRects ( blocks,imRect,changedRegions );
+    bool grown=true;
+    while ( grown )
+    {
+        grown=false;
+        for ( size_t r=0;r<changedRegions.size();r++ )
+            for ( size_t b=0;b<boxes.size();b++ )
+            {
+                Rect box ( boxes[b].x-2,boxes[b].y-2,boxes[b].width+4,boxes[b].height+4 );
+                if ( ( box&changedRegions[r] ).area() >0 && ( box|changedRegions[r] ) !=changedRegions[r] )
+                {
+                    changedRegions[r]= ( changedRegions[r]|box ) &imRect;
+                    grown=true;
+                }
+            }
+        if ( grown ) mergeRects ( vector<Rect> ( changedRegions ),imRect,changedRegions );
+    }
+    _gatePartial++;
+    return FRAME_PARTIAL;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerDetector::thresHoldROI ( const RoiLevel &roi,const cv::Mat &grey,cv::Mat &thresImg,double param1,double param2,bool clearOutside )
+{
+    if ( clearOutside ) resetThresholded ( thresImg,grey.size(),&roi.rects );
+    else
+    {
+        thresImg.create ( grey.size(),CV_8UC1 );
+        if ( !_thresWrittenAll ) _thresWritten.insert ( _thresWritten.end(),roi.rects.begin(),roi.rects.end() );
+    }
+    Rect imRect ( 0,0,grey.cols,grey.rows );
+    //margin so that the neighbourhood of the pixels near the limits of the regions is the same than in the whole image
+    int margin=std::max ( 3,int ( param1 ) ) +1;
+    Mat sub,subEroded;
+    for ( size_t r=0;r<roi.rects.size();r++ )
+    {
+        const Rect &rect=roi.rects[r];
+        Rect ext=Rect ( rect.x-margin,rect.y-margin,rect.width+2*margin,rect.height+2*margin ) &imRect;
+        thresHold ( _thresMethod,grey ( ext ),sub,param1,param2 );
+        if ( _doErosion && _thresMethod!=EDGE_SEGMENTS )
+        {
+            erode ( sub,subEroded,cv::Mat() );
+            sub=subEroded;
+        }
+        Mat dst=thresImg ( rect );
+        sub ( Rect ( rect.x-ext.x,rect.y-ext.y,rect.width,rect.height ) ).copyTo ( dst );
+        clearOutsideSpans ( roi,rect,thresImg );
+    }
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerDetector::resetThresholded ( cv::Mat &thresImg,cv::Size size,const std::vector<cv::Rect> *regions )
+{
+    if ( regions==NULL )
+    {
+        //the whole image is going to be written
+        _thresWrittenAll=true;
+        _thresWritten.clear();
+        return;
+    }
+    if ( thresImg.size() !=size || thresImg.type() !=CV_8UC1 )
+    {
+        thresImg.create ( size,CV_8UC1 );
+        thresImg.setTo ( Scalar::all ( 0 ) );
+    }
+    else if ( _thresWrittenAll ) thresImg.setTo ( Scalar::all ( 0 ) );
+    else
+    {
+        //only the regions written in the last call
+        for ( size_t r=0;r<_thresWritten.size();r++ )
+        {
+            Mat dst=thresImg ( _thresWritten[r] );
+            dst.setTo ( Scalar::all ( 0 ) );
+        }
+    }
+    _thresWrittenAll=false;
+    _thresWritten=*regions;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerDetector::clearOutsideSpans ( const RoiLevel &roi,const cv::Rect &rect,cv::Mat &thresImg )
+{
+    //pixels out of the mask are removed
+    if ( roi.rowSpans.size() ==0 ) return;
+    for ( int y=rect.y;y<rect.y+rect.height;y++ )
+    {
+        uchar *row=thresImg.ptr<uchar> ( y );
+        const vector<Vec2i> &spans=roi.rowSpans[y];
+        int x=rect.x,xEnd=rect.x+rect.width;
+        for ( size_t s=0;s<spans.size();s++ )
+        {
+            int start=std::max ( spans[s][0],rect.x ),end=std::min ( spans[s][1],xEnd );
+            if ( end<=start ) continue;
+            if ( start>x ) memset ( row+x,0,start-x );
+            x=std::max ( x,end );
+        }
+        if ( xEnd>x ) memset ( row+x,0,xEnd-x );
+    }
+}
+
+/**Adaptive threshold (ADAPTIVE_THRESH_MEAN_C and THRESH_BINARY_INV) of grey, with the means of the blocks obtained from sum,
+ * the integral image of grey padded by replicating pad pixels of its border. It gives the same result than cv::adaptiveThreshold
+ */
+template<typename T>
+static void adaptiveThresholdIntegral ( const cv::Mat &grey,const cv::Mat &sum,int pad,int blockSize,double C,cv::Mat &out )
+{
+    out.create ( grey.size(),CV_8UC1 );
+    int r=blockSize/2;
+    double scale=1./ ( blockSize*blockSize );
+    int idelta=cvFloor ( C );
+    for ( int y=0;y<grey.rows;y++ )
+    {
+        //rows of the integral image above and below the block centered in the padded pixel (x+pad,y+pad)
+        const T *top=sum.ptr<T> ( y+pad-r ),*bottom=sum.ptr<T> ( y+pad+r+1 );
+        const uchar *src=grey.ptr<uchar> ( y );
+        uchar *dst=out.ptr<uchar> ( y );
+        for ( int x=0;x<grey.cols;x++ )
+        {
+            int x0=x+pad-r,x1=x+pad+r+1;
+            int mean=cvRound ( double ( bottom[x1]-bottom[x0]-top[x1]+top[x0] ) *scale );
+            dst[x]= ( src[x]-mean<=-idelta ) ?255:0;
+        }
+    }
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerDetector::detectRectanglesMulti ( const cv::Mat &grey,const std::vector<std::pair<double,double> > &params,const RoiLevel *roi,vector<MarkerCandidate> &candidates )
+{
+    ARUCO_STATS_TIC(tick);
+    vector<std::pair<double,double> > thresParams ( params );
+    int pad=0;
+    if ( _thresMethod==ADPT_THRES )
+    {
+        //odd block sizes, as in thresHold
+        for ( size_t v=0;v<thresParams.size();v++ )
+        {
+            double &blockSize=thresParams[v].first;
+            if ( blockSize<3 ) blockSize=3;
+            else if ( ( ( int ) blockSize ) %2 !=1 ) blockSize= ( int ) ( blockSize+1 );
+            pad=std::max ( pad, ( int ) blockSize/2 );
+        }
+    }
+    _multiThres.resize ( thresParams.size() );
+    if ( roi!=NULL )
+        for ( size_t v=0;v<_multiThres.size();v++ ) _multiThres[v].create ( grey.size(),CV_8UC1 );
+    //the whole image, or each region of interest (the pixels out of them are not read by findRectangles)
+    Rect imRect ( 0,0,grey.cols,grey.rows );
+    vector<Rect> areas;
+    if ( roi==NULL ) areas.push_back ( imRect );
+    else areas=roi->rects;
+    for ( size_t a=0;a<areas.size();a++ )
+    {
+        const Rect &area=areas[a];
+        //one more pixel for the erosion
+        Rect ext=Rect ( area.x-1,area.y-1,area.width+2,area.height+2 ) &imRect;
+        Mat sub=grey ( ext );
+        if ( _thresMethod==ADPT_THRES )
+        {
+            //the means of the blocks of all sizes are obtained from the same integral image. 32 bits integers are enough unless the image is huge.
+            //The border is made of the pixels of the image around the area, or replicated at the limits of the image
+            cv::copyMakeBorder ( sub,_multiThresPadded,pad,pad,pad,pad,cv::BORDER_REPLICATE );
+            bool fitsInt= double ( _multiThresPadded.total() ) *255. < double ( std::numeric_limits<int>::max() );
+            cv::integral ( _multiThresPadded,_multiThresSum,fitsInt?CV_32S:CV_64F );
+        }
+        #pragma omp parallel for
+        for ( int v=0;v<int ( thresParams.size() );v++ )
+        {
+            Mat out;
+            if ( _thresMethod==FIXED_THRES )
+                cv::threshold ( sub,out,thresParams[v].first,255,CV_THRESH_BINARY_INV );
+            else if ( _multiThresSum.depth() ==CV_32S )
+                adaptiveThresholdIntegral<int> ( sub,_multiThresSum,pad,int ( thresParams[v].first ),thresParams[v].second,out );
+            else
+                adaptiveThresholdIntegral<double> ( sub,_multiThresSum,pad,int ( thresParams[v].first ),thresParams[v].second,out );
+            if ( _doErosion )
+            {
+                Mat eroded;
+                erode ( out,eroded,cv::Mat() );
+                out=eroded;
+            }
+            if ( roi==NULL ) _multiThres[v]=out;
+            else
+            {
+                Mat dst=_multiThres[v] ( area );
+                out ( Rect ( area.x-ext.x,area.y-ext.y,area.width,area.height ) ).copyTo ( dst );
+                clearOutsideSpans ( *roi,area,_multiThres[v] );
+            }
+        }
+    }
+    //the image returned by getThresholdedImage is the one of the first pair
+    if ( roi==NULL )
+    {
+        resetThresholded ( thres,grey.size(),NULL );
+        _multiThres[0].copyTo ( thres );
+    }
+    else
+    {
+        resetThresholded ( thres,grey.size(),&roi->rects );
+        for ( size_t r=0;r<roi->rects.size();r++ )
+        {
+            Mat dst=thres ( roi->rects[r] );
+            _multiThres[0] ( roi->rects[r] ).copyTo ( dst );
+        }
+    }
+    ARUCO_STATS_TOC(tick,tThreshold);
+
+    //the candidates of all the images are merged before removing the repeated ones, so that each marker is identified once
+    vector<MarkerCandidate> allCandidates;
+    for ( size_t v=0;v<_multiThres.size();v++ )
+        findRectangles ( _multiThres[v],allCandidates,roi!=NULL?&roi->rects:NULL );
+    removeRepeatedCandidates ( allCandidates,candidates );
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+int MarkerDetector::findInIdentityCache ( const std::vector<cv::Point2f> &candidate,int &nRotations ) const
+{
+    float tol2=_idCacheTolerance*_idCacheTolerance;
+    for ( size_t e=0;e<_idCache.size();e++ )
+    {
+        const vector<Point2f> &prev=_idCache[e].corners;
+        //the corner order of the candidate may start at a different corner: find the shift s such that candidate[(k+s)%4] ~ prev[k]
+        for ( int s=0;s<4;s++ )
+        {
+            bool match=true;
+            for ( int k=0;k<4 && match;k++ )
+            {
+                Point2f d=candidate[ ( k+s ) %4]-prev[k];
+                match= d.x*d.x+d.y*d.y<=tol2;
+            }
+            if ( match )
+            {
+                //the marker corners are the candidate ones rotated 4-nRotations positions. So, with the shift, it is nRotations-s
+                nRotations= ( _idCache[e].nRotations-s+4 ) %4;
+                return int ( e );
+            }
+        }
+    }
+    return -1;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+bool MarkerDetector::checkMarkerBorder ( const std::vector<cv::Point2f> &candidate,const cv::Mat &grey ) const
+{
+    int G=_idCacheGridSize;
+    Point2f gridCorners[4]={Point2f ( 0,0 ),Point2f ( G,0 ),Point2f ( G,G ),Point2f ( 0,G ) };
+    Point2f imCorners[4]={candidate[0],candidate[1],candidate[2],candidate[3]};
+    Mat H=getPerspectiveTransform ( gridCorners,imCorners );
+    //centers of the cells of the border, and points at half a cell outside the marker
+    vector<Point2f> gridPoints,imPoints;
+    for ( int k=0;k<G;k++ )
+    {
+        float c=k+0.5f;
+        gridPoints.push_back ( Point2f ( c,0.5f ) ); gridPoints.push_back ( Point2f ( c,G-0.5f ) );
+        gridPoints.push_back ( Point2f ( 0.5f,c ) ); gridPoints.push_back ( Point2f ( G-0.5f,c ) );
+    }
+    size_t nBorder=gridPoints.size();
+    for ( int k=0;k<G;k++ )
+    {
+        float c=k+0.5f;
+        gridPoints.push_back ( Point2f ( c,-0.5f ) ); gridPoints.push_back ( Point2f ( c,G+0.5f ) );
+        gridPoints.push_back ( Point2f ( -0.5f,c ) ); gridPoints.push_back ( Point2f ( G+0.5f,c ) );
+    }
+    perspectiveTransform ( gridPoints,imPoints,H );
+    vector<int> values ( imPoints.size(),-1 );
+    double borderMean=0,outMean=0;
+    int nOut=0;
+    for ( size_t i=0;i<imPoints.size();i++ )
+    {
+        int x=cvRound ( imPoints[i].x ),y=cvRound ( imPoints[i].y );
+        if ( x<0 || y<0 || x>=grey.cols || y>=grey.rows )
+        {
+            if ( i<nBorder ) return false;
+            continue;//outside points may be out of the image
+        }
+        values[i]=grey.at<uchar> ( y,x );
+        if ( i<nBorder ) borderMean+=values[i];
+        else { outMean+=values[i]; nOut++; }
+    }
+    if ( nOut==0 ) return false;
+    borderMean/=double ( nBorder );
+    outMean/=double ( nOut );
+    if ( outMean-borderMean<20 ) return false;
+    //nearly all border cells must be below the midpoint
+    double mid= ( borderMean+outMean ) /2;
+    int nDark=0;
+    for ( size_t i=0;i<nBorder;i++ ) if ( values[i]<mid ) nDark++;
+    return nDark>=0.9*nBorder;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+uint64 MarkerDetector::candidateKey ( const std::vector<cv::Point2f> &candidate,const cv::Mat &grey,int quantStep,int &startCorner ) const
+{
+    //quantized corners. The first one is the top-most (left-most in case of tie), so that the key does not depend
+    //on the corner from which the contour was traced. Candidates are always anticlockwise, so the rest follow
+    Point q[4];
+    startCorner=0;
+    for ( int c=0;c<4;c++ )
+    {
+        q[c]=Point ( cvFloor ( candidate[c].x/quantStep ),cvFloor ( candidate[c].y/quantStep ) );
+        if ( q[c].y<q[startCorner].y || ( q[c].y==q[startCorner].y && q[c].x<q[startCorner].x ) ) startCorner=c;
+    }
+    //FNV-1a
+    uint64 key=14695981039346656037ULL;
+    const uint64 prime=1099511628211ULL;
+    for ( int c=0;c<4;c++ )
+    {
+        key= ( key^uint64 ( q[ ( startCorner+c ) %4].x ) ) *prime;
+        key= ( key^uint64 ( q[ ( startCorner+c ) %4].y ) ) *prime;
+    }
+    //appearance: 3x3 pixels inside the quad (bilinear interpolation of the corners) binarized by their mean,
+    //and the mean itself coarsely quantized
+    const Point2f &p0=candidate[startCorner],&p1=candidate[ ( startCorner+1 ) %4],&p2=candidate[ ( startCorner+2 ) %4],&p3=candidate[ ( startCorner+3 ) %4];
+    int values[9],sum=0;
+    for ( int v=0;v<3;v++ )
+        for ( int u=0;u<3;u++ )
+        {
+            float fu=0.25f* ( u+1 ),fv=0.25f* ( v+1 );
+            Point2f p= ( p0* ( 1-fu ) +p1*fu ) * ( 1-fv ) + ( p3* ( 1-fu ) +p2*fu ) *fv;
+            int x=std::max ( 0,std::min ( grey.cols-1,cvRound ( p.x ) ) );
+            int y=std::max ( 0,std::min ( grey.rows-1,cvRound ( p.y ) ) );
+            values[v*3+u]=grey.at<uchar> ( y,x );
+            sum+=values[v*3+u];
+        }
+    int mean=sum/9;
+    int pattern=0;
+    for ( int k=0;k<9;k++ ) if ( values[k]>mean ) pattern|= ( 1<<k );
+    key= ( key^uint64 ( pattern ) ) *prime;
+    key= ( key^uint64 ( mean/32 ) ) *prime;
+    return key;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+float MarkerDetector::expectedPixelsPerBit ( cv::Size imSize )const
+{
+    //side of the smallest marker allowed by setMinMaxSize
+    float minSide=_minSize*std::max ( imSize.width,imSize.height );
+    //if markers were seen in the previous frame, the smallest of them (with a margin) is a better guess.
+    //A marker smaller than it might appear, but it will be detected as soon as it gets the size of the rest
+    if ( _observedMinSide>0 ) minSide=std::max ( minSide,_observedMinSide*_autoScaleMargin );
+    return minSide/float ( _autoScaleGridSize );
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+int MarkerDetector::selectAutoScaleLevel ( cv::Size imSize )const
+{
+    //the canonical image does not get more than warpSize/gridSize pixels per bit, so more are never required
+    float requiredPixelsPerBit=std::min ( _autoScaleMinPixelsPerBit,float ( _activeSpeed.warpSize ) /float ( _autoScaleGridSize ) );
+    float pixelsPerBit=expectedPixelsPerBit ( imSize );
+    //coarsest level at which the smallest marker still has enough pixels per bit
+    int level=0;
+    while ( level<_autoScaleMaxLevel && pixelsPerBit/ImagePyramid::getScale ( level+1 ) >=requiredPixelsPerBit ) level++;
+    return level;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerDetector::cornerSubPixParallel ( const cv::Mat &img,vector<Point2f> &Corners,float scale )
+{
+    //cornerSubPix refines each corner independently, so the markers are split among the threads
+    //obtaining the same result than in a single call
+    int nMarkers=Corners.size() /4;
+    int nChunks=std::min ( omp_get_max_threads(),nMarkers );
+    #pragma omp parallel for
+    for ( int t=0;t<nChunks;t++ )
+    {
+        size_t from=4* ( ( nMarkers *t ) /nChunks );
+        size_t to=4* ( ( nMarkers * ( t+1 ) ) /nChunks );
+        vector<Point2f> chunk ( Corners.begin()+from,Corners.begin()+to );
+        if ( scale!=1 )
+            for ( size_t i=0;i<chunk.size();i++ ) chunk[i]*= ( 1.f/scale );
+        cornerSubPix ( img, chunk,cvSize ( 5,5 ), cvSize ( -1,-1 )   ,cvTermCriteria ( CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,3,0.05 ) );
+        if ( scale!=1 )
+            for ( size_t i=0;i<chunk.size();i++ ) chunk[i]*=scale;
+        std::copy ( chunk.begin(),chunk.end(),Corners.begin()+from );
+    }
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerDetector::sortCandidatesByPriority ( vector<MarkerCandidate> &candidates,const cv::Mat &grey )
+{
+    vector<pair<float,int> > priority ( candidates.size() );
+    for ( size_t i=0;i<candidates.size();i++ )
+    {
+        MarkerCandidate &mc=candidates[i];
+        float p=0;
+        if ( _candidatePriority==PRIORITY_TRACKED && _prevMarkerCenters.size() >0 )
+        {
+            //the nearer to a previous marker, the better
+            Point2f center=mc.getCenter();
+            float minDist=std::numeric_limits<float>::max();
+            for ( size_t m=0;m<_prevMarkerCenters.size();m++ )
+            {
+                Point2f d=center-_prevMarkerCenters[m];
+                minDist=std::min ( minDist,d.x*d.x+d.y*d.y );
+            }
+            p=-minDist;
+        }
+        else if ( _candidatePriority==PRIORITY_CONTRAST )
+        {
+            //difference between pixels just outside and just inside the middle of each side.
+            //Markers have a black border on a white background
+            Point2f center=mc.getCenter();
+            for ( int c=0;c<4;c++ )
+            {
+                Point2f mid= ( mc[c]+mc[ ( c+1 ) %4] ) *0.5f;
+                Point2f toCenter= ( center-mid ) *0.1f;
+                Point pIn ( cvRound ( mid.x+toCenter.x ),cvRound ( mid.y+toCenter.y ) );
+                Point pOut ( cvRound ( mid.x-toCenter.x ),cvRound ( mid.y-toCenter.y ) );
+                pIn.x=std::max ( 0,std::min ( grey.cols-1,pIn.x ) );
+                pIn.y=std::max ( 0,std::min ( grey.rows-1,pIn.y ) );
+                pOut.x=std::max ( 0,std::min ( grey.cols-1,pOut.x ) );
+                pOut.y=std::max ( 0,std::min ( grey.rows-1,pOut.y ) );
+                p+=float ( grey.at<uchar> ( pOut ) )-float ( grey.at<uchar> ( pIn ) );
+            }
+        }
+        else p=perimeter ( mc ); //PRIORITY_SIZE
+        priority[i]=pair<float,int> ( -p,i );
+    }
+    std::sort ( priority.begin(),priority.end() );
+    vector<MarkerCandidate> sorted ( candidates.size() );
+    for ( size_t i=0;i<priority.size();i++ )
+        sorted[i]=candidates[priority[i].second];
+    candidates.swap ( sorted );
+}
+
+
+/************************************
+ *
+ * Crucial step. Detects the rectangular regions of the thresholded image
+ *
+ *
+ ************************************/
+void  MarkerDetector::detectRectangles ( const cv::Mat &thres,vector<std::vector<cv::Point2f> > &MarkerCanditates )
+{
+    vector<MarkerCandidate>  candidates;
+    detectRectangles(thres,candidates);
+    //create the output
+    MarkerCanditates.resize(candidates.size());
+    for (size_t i=0;i<MarkerCanditates.size();i++)
+        MarkerCanditates[i]=candidates[i];
+}
+
+void MarkerDetector::detectRectangles(const cv::Mat &thresImg,vector<MarkerCandidate> & OutMarkerCanditates,const std::vector<cv::Rect> *regions)
+{
+    vector<MarkerCandidate>  MarkerCanditates;
+    findRectangles(thresImg,MarkerCanditates,regions);
+    //in hierarchy mode, each marker gives a single candidate
+    if ( _contourMode==CONTOURS_HIERARCHY ) OutMarkerCanditates.insert(OutMarkerCanditates.end(),MarkerCanditates.begin(),MarkerCanditates.end());
+    else removeRepeatedCandidates(MarkerCanditates,OutMarkerCanditates);
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerDetector::findRectangles(const cv::Mat &thresImg,vector<MarkerCandidate> & OutMarkerCanditates,const std::vector<cv::Rect> *regions)
+{
+    vector<MarkerCandidate>  MarkerCanditates;
+    //calcualte the min_max contour sizes
+    unsigned int minSize=_minSize*std::max(thresImg.cols,thresImg.rows)*4;
+    unsigned int maxSize=_maxSize*std::max(thresImg.cols,thresImg.rows)*4;
+    std::vector<std::vector<cv::Point> > contours2;
+    std::vector<cv::Vec4i> hierarchy2;
+
+    //in hierarchy mode, the two level hierarchy leaves the outer boundaries of the dark regions at the top level
+    //and the boundaries of their holes at the second one
+    bool useHierarchy= ( _contourMode==CONTOURS_HIERARCHY );
+    int retrievalMode=useHierarchy?CV_RETR_CCOMP:CV_RETR_LIST;
+    ARUCO_STATS_TIC(tick);
+    if ( regions==NULL )
+    {
+        thresImg.copyTo ( thres2 );
+        cv::findContours ( thres2 , contours2, hierarchy2,retrievalMode, CV_CHAIN_APPROX_NONE );
+    }
+    else
+    {
+        //trace the contours of each region, with the coordinates of the whole image
+        std::vector<std::vector<cv::Point> > regionContours;
+        std::vector<cv::Vec4i> regionHierarchy;
+        for ( size_t r=0;r<regions->size();r++ )
+        {
+            thresImg ( ( *regions ) [r] ).copyTo ( thres2 );
+            cv::findContours ( thres2 , regionContours, regionHierarchy,retrievalMode, CV_CHAIN_APPROX_NONE, ( *regions ) [r].tl() );
+            contours2.insert ( contours2.end(),regionContours.begin(),regionContours.end() );
+            //only the parent index is used later, and it is a hole or not irrespective of the region
+            hierarchy2.insert ( hierarchy2.end(),regionHierarchy.begin(),regionHierarchy.end() );
+        }
+    }
+    ARUCO_STATS_TOC(tick,tContours);
+    ARUCO_STATS_ADD(nContours,contours2.size());
+    vector<Point>  approxCurve;
+    ///for each contour, analyze if it is a paralelepiped likely to be the marker
+    for ( unsigned int i=0;i<contours2.size();i++ )
+    {
+        //the boundaries of the holes are the inner edges of regions whose outer edge is analyzed
+        if ( useHierarchy && hierarchy2[i][3]>=0 ) {
+            ARUCO_STATS_ADD(nRejected[FILTER_HOLE],1);
+            continue;
+        }
+        //check it is a possible element by first checking is has enough points
+        if ( contours2[i].size()<=minSize || contours2[i].size()>=maxSize ) {
+            ARUCO_STATS_ADD(nRejected[FILTER_CONTOUR_SIZE],1);
+            continue;
+        }
+        //approximate to a poligon and check that the poligon has 4 points
+        approxPolyDP (  contours2[i]  ,approxCurve , double ( contours2[i].size() ) *0.05 , true );
+        if ( approxCurve.size() !=4 ) {
+            ARUCO_STATS_ADD(nRejected[FILTER_POLYGON],1);
+            continue;
+        }
+        //apply the rest of filters in the order indicated
+        int rejectedBy=applyCandidateFilters(approxCurve,thresImg.size());
+        if ( rejectedBy!=-1 ) {
+            ARUCO_STATS_ADD(nRejected[rejectedBy],1);
+            continue;
+        }
+        //add the points
+        MarkerCanditates.push_back ( MarkerCandidate() );
+        MarkerCanditates.back().idx=i;
+        for ( int j=0;j<4;j++ )
+            MarkerCanditates.back().push_back ( Point2f ( approxCurve[j].x,approxCurve[j].y ) );
+    }
+
+    ///sort the points in anti-clockwise order
+    valarray<bool> swapped(false,MarkerCanditates.size());//used later
+    for ( unsigned int i=0;i<MarkerCanditates.size();i++ )
+    {
+
+        //trace a line between the first and second point.
+        //if the thrid point is at the right side, then the points are anti-clockwise
+        double dx1 = MarkerCanditates[i][1].x - MarkerCanditates[i][0].x;
+        double dy1 =  MarkerCanditates[i][1].y - MarkerCanditates[i][0].y;
+        double dx2 = MarkerCanditates[i][2].x - MarkerCanditates[i][0].x;
+        double dy2 = MarkerCanditates[i][2].y - MarkerCanditates[i][0].y;
+        double o = ( dx1*dy2 )- ( dy1*dx2 );
+
+        if ( o  < 0.0 )		 //if the third point is in the left side, then sort in anti-clockwise order
+        {
+            swap ( MarkerCanditates[i][1],MarkerCanditates[i][3] );
+            swapped[i]=true;
+        }
+    }
+    ARUCO_STATS_TOC(tick,tQuadFilter);
+
+    //finally, assign to the candidates the contour
+    OutMarkerCanditates.reserve(OutMarkerCanditates.size()+MarkerCanditates.size());
+    for (size_t i=0;i<MarkerCanditates.size();i++) {
+        OutMarkerCanditates.push_back(MarkerCanditates[i]);
+        OutMarkerCanditates.back().contour.swap(contours2[ MarkerCanditates[i].idx]);
+        if (swapped[i] )//if the corners where swapped, it is required to reverse here the points so that they are in the same order
+            reverse(OutMarkerCanditates.back().contour.begin(),OutMarkerCanditates.back().contour.end());//????
+    }
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerDetector::removeRepeatedCandidates(vector<MarkerCandidate> &MarkerCanditates,vector<MarkerCandidate> &OutMarkerCanditates)
+{
+    ARUCO_STATS_TIC(tick);
+    /// remove these elements which corners are too close to each other
+    vector<bool> toRemove ( MarkerCanditates.size(),false );
+    removeTooNearCandidates(MarkerCanditates,toRemove);
+    OutMarkerCanditates.reserve(OutMarkerCanditates.size()+MarkerCanditates.size());
+    size_t nRemoved=0;
+    for (size_t i=0;i<MarkerCanditates.size();i++) {
+        if (toRemove[i]) nRemoved++;
+        else OutMarkerCanditates.push_back(MarkerCanditates[i]);
+    }
+    ARUCO_STATS_ADD(nRejected[FILTER_TOO_NEAR],nRemoved);
+    ARUCO_STATS_TOC(tick,tDuplicates);
+}
+
+/**Straight segment of edge pixels. All segments are oriented so that the dark side is at the same side, and thus,
+ * the sides of a dark quadrilateral follow one another when going from p0 to p1
+ */
+struct EdgeSegment
+{
+    cv::Point2f p0,p1;
+    cv::Point2f dir;//unitary, from p0 to p1
+    float length;
+};
+
+/**Link between the end of a segment and the start of the next side of a quadrilateral
+ */
+struct SegmentLink
+{
+    int to;
+    cv::Point2f corner;//intersection of the lines of both segments
+};
+
+static inline float cross2(const cv::Point2f &a,const cv::Point2f &b){return a.x*b.y-a.y*b.x;}
+
+//finds, for each segment i, the segments j whose start is nearer to the end of i than base+factor*max(length of i,length of j),
+//in increasing order of j. The starts and the ends are put in a grid. Each segment looks for the starts near its end and for the
+//ends near its start in a radius given by its own length, so that a long segment does not make all the searches wider
+static void findNearbySegments(const vector<EdgeSegment> &segments,float base,float factor,vector<vector<int> > &nearby)
+{
+    nearby.assign(segments.size(),vector<int>());
+    if (segments.empty()) return;
+    const float cellSize=16;
+    float minX=segments[0].p0.x,minY=segments[0].p0.y,maxX=minX,maxY=minY;
+    for (size_t i=0;i<segments.size();i++)
+    {
+        minX=std::min(minX,std::min(segments[i].p0.x,segments[i].p1.x));
+        minY=std::min(minY,std::min(segments[i].p0.y,segments[i].p1.y));
+        maxX=std::max(maxX,std::max(segments[i].p0.x,segments[i].p1.x));
+        maxY=std::max(maxY,std::max(segments[i].p0.y,segments[i].p1.y));
+    }
+    int cols=cvFloor((maxX-minX)/cellSize)+1,rows=cvFloor((maxY-minY)/cellSize)+1;
+    vector<vector<int> > starts(cols*rows),ends(cols*rows);
+    for (size_t i=0;i<segments.size();i++)
+    {
+        starts[cvFloor((segments[i].p0.y-minY)/cellSize)*cols+cvFloor((segments[i].p0.x-minX)/cellSize)].push_back(i);
+        ends[cvFloor((segments[i].p1.y-minY)/cellSize)*cols+cvFloor((segments[i].p1.x-minX)/cellSize)].push_back(i);
+    }
+    //first, the starts near the end of each segment, and then the ends near its start
+    for (int pass=0;pass<2;pass++)
+        for (size_t i=0;i<segments.size();i++)
+        {
+            const cv::Point2f &p= pass==0?segments[i].p1:segments[i].p0;
+            float radius=base+factor*segments[i].length;
+            int x0=std::max(0,cvFloor((p.x-radius-minX)/cellSize)),x1=std::min(cols-1,cvFloor((p.x+radius-minX)/cellSize));
+            int y0=std::max(0,cvFloor((p.y-radius-minY)/cellSize)),y1=std::min(rows-1,cvFloor((p.y+radius-minY)/cellSize));
+            for (int y=y0;y<=y1;y++)
+                for (int x=x0;x<=x1;x++)
+                {
+                    const vector<int> &cell= pass==0?starts[y*cols+x]:ends[y*cols+x];
+                    for (size_t k=0;k<cell.size();k++)
+                    {
+                        int j=cell[k];
+                        cv::Point2f d=( pass==0?segments[j].p0:segments[j].p1 )-p;
+                        float dist=sqrt(d.dot(d));
+                        if (dist>radius) continue;
+                        if (pass==0) nearby[i].push_back(j);
+                        //the end of j near the start of i, unless already found from j in the first pass
+                        else if (dist>base+factor*segments[j].length) nearby[j].push_back(i);
+                    }
+                }
+        }
+    for (size_t i=0;i<nearby.size();i++) std::sort(nearby[i].begin(),nearby[i].end());
+}
+
+//unitary sobel gradient of grey in (x,y), that must not be in the image limits. Returns false if it is null
+static inline bool unitGradient(const cv::Mat &grey,int x,int y,cv::Point2f &g)
+{
+    const uchar *r0=grey.ptr<uchar>(y-1),*r1=grey.ptr<uchar>(y),*r2=grey.ptr<uchar>(y+1);
+    float gx=float( (r0[x+1]+2*r1[x+1]+r2[x+1])-(r0[x-1]+2*r1[x-1]+r2[x-1]) );
+    float gy=float( (r2[x-1]+2*r2[x]+r2[x+1])-(r0[x-1]+2*r0[x]+r0[x+1]) );
+    float norm=sqrt(gx*gx+gy*gy);
+    if (norm==0) return false;
+    g=cv::Point2f(gx/norm,gy/norm);
+    return true;
+}
+
+//groups the edge pixels in area by growing regions of neighbour pixels whose gradient has an orientation similar to the mean
+//of the region, and fits a line to each one. visited marks the pixels already employed, and is only modified inside area
+static void extractEdgeSegments(const cv::Mat &grey,const cv::Mat &edges,const cv::Rect &area,cv::Mat &visited,float minLength,vector<EdgeSegment> &segments)
+{
+    const float cosTol=0.92f;//about 23 degrees
+    const float maxDist=1.5f;//max distance of a pixel to the line of its segment
+    //the gradient can not be computed in the limits of the image
+    int x0=std::max(area.x,1),y0=std::max(area.y,1);
+    int x1=std::min(area.x+area.width,grey.cols-1),y1=std::min(area.y+area.height,grey.rows-1);
+    vector<cv::Point> stack,region;
+    for (int y=y0;y<y1;y++)
+    {
+        const uchar *edgesRow=edges.ptr<uchar>(y);
+        uchar *visitedRow=visited.ptr<uchar>(y);
+        for (int x=x0;x<x1;x++)
+        {
+            if (edgesRow[x]==0 || visitedRow[x]!=0) continue;
+            visitedRow[x]=1;
+            cv::Point2f sumGrad,meanGrad;
+            if (!unitGradient(grey,x,y,sumGrad)) continue;
+            meanGrad=sumGrad;
+            region.clear();
+            stack.assign(1,cv::Point(x,y));
+            while (!stack.empty())
+            {
+                cv::Point p=stack.back();
+                stack.pop_back();
+                region.push_back(p);
+                for (int ny=std::max(p.y-1,y0);ny<=std::min(p.y+1,y1-1);ny++)
+                    for (int nx=std::max(p.x-1,x0);nx<=std::min(p.x+1,x1-1);nx++)
+                    {
+                        if (edges.at<uchar>(ny,nx)==0 || visited.at<uchar>(ny,nx)!=0) continue;
+                        cv::Point2f g;
+                        //pixels with a different orientation are left for other regions
+                        if (!unitGradient(grey,nx,ny,g) || g.dot(meanGrad)<cosTol) continue;
+                        visited.at<uchar>(ny,nx)=1;
+                        stack.push_back(cv::Point(nx,ny));
+                        sumGrad+=g;
+                        meanGrad=sumGrad*float(1./sqrt(sumGrad.dot(sumGrad)));
+                    }
+            }
+            if (region.size()<minLength) continue;
+            LineFitter fitter;
+            for (size_t i=0;i<region.size();i++) fitter.add(cv::Point2f(region[i].x,region[i].y));
+            cv::Point3d line;
+            if (!fitter.fit(line)) continue;
+            //direction of the line, with the gradient (towards the light side) at its left
+            cv::Point2f normal(line.x,line.y),dir(-line.y,line.x);
+            if (cross2(dir,meanGrad)<0) dir=-dir;
+            //extremes along the line, and straightness of the region
+            float tMin=std::numeric_limits<float>::max(),tMax=-tMin,worst=0;
+            for (size_t i=0;i<region.size();i++)
+            {
+                cv::Point2f p(region[i].x,region[i].y);
+                float t=p.dot(dir);
+                tMin=std::min(tMin,t);
+                tMax=std::max(tMax,t);
+                worst=std::max(worst,float(fabs(p.dot(normal)+line.z)));
+            }
+            if (worst>maxDist || tMax-tMin<minLength) continue;
+            //the point of the line nearest to the origin, from which the extremes are measured
+            cv::Point2f origin=normal*float(-line.z);
+            EdgeSegment seg;
+            seg.p0=origin+dir*tMin;
+            seg.p1=origin+dir*tMax;
+            seg.dir=dir;
+            seg.length=tMax-tMin;
+            segments.push_back(seg);
+        }
+    }
 }
 
-
 /************************************
  *
- * Crucial step. Detects the rectangular regions of the thresholded image
+ *
  *
  *
  ************************************/
-void  MarkerDetector::detectRectangles ( const cv::Mat &thres,vector<std::vector<cv::Point2f> > &MarkerCanditates )
-{
-    vector<MarkerCandidate>  candidates;
-    detectRectangles(thres,candidates);
-    //create the output
-    MarkerCanditates.resize(candidates.size());
-    for (size_t i=0;i<MarkerCanditates.size();i++)
-        MarkerCanditates[i]=candidates[i];
-}
-
-void MarkerDetector::detectRectangles(const cv::Mat &thresImg,vector<MarkerCandidate> & OutMarkerCanditates)
+void MarkerDetector::detectSegmentQuads(const cv::Mat &grey,const cv::Mat &edgesImg,vector<MarkerCandidate> & OutMarkerCanditates,const std::vector<cv::Rect> *regions)
 {
+    if ( grey.type() !=CV_8UC1 || edgesImg.type() !=CV_8UC1 || grey.size() !=edgesImg.size() )
+        throw cv::Exception ( 9001,"grey and edgesImg must be CV_8UC1 images of the same size","MarkerDetector::detectSegmentQuads",__FILE__,__LINE__ );
     vector<MarkerCandidate>  MarkerCanditates;
-    //calcualte the min_max contour sizes
-    int minSize=_minSize*std::max(thresImg.cols,thresImg.rows)*4;
-    int maxSize=_maxSize*std::max(thresImg.cols,thresImg.rows)*4;
-    std::vector<std::vector<cv::Point> > contours2;
-    std::vector<cv::Vec4i> hierarchy2;
-
-    thresImg.copyTo ( thres2 );
-    cv::findContours ( thres2 , contours2, hierarchy2,CV_RETR_LIST, CV_CHAIN_APPROX_NONE );
-    vector<Point>  approxCurve;
-    ///for each contour, analyze if it is a paralelepiped likely to be the marker
-
-    for ( unsigned int i=0;i<contours2.size();i++ )
+    //the contour size limits are applied to the perimeter
+    float minSize=_minSize*std::max(grey.cols,grey.rows)*4;
+    float maxSize=_maxSize*std::max(grey.cols,grey.rows)*4;
+    //segments may be shorter than the sides if these are partially occluded
+    float minLength=std::max(4.f,_minSideLength*0.5f);
+
+    ARUCO_STATS_TIC(tick);
+    //the regions are split in horizontal bands processed in parallel. The segments cut by the limits of the bands are joined later
+    vector<cv::Rect> areas;
+    vector<cv::Rect> wholeImage(1,cv::Rect(0,0,grey.cols,grey.rows));
+    const vector<cv::Rect> &rects= regions!=NULL?*regions:wholeImage;
+    int nBands=omp_get_max_threads();
+    for (size_t r=0;r<rects.size();r++)
+    {
+        int bandHeight=std::max(32,(rects[r].height+nBands-1)/nBands);
+        for (int y=rects[r].y;y<rects[r].y+rects[r].height;y+=bandHeight)
+            areas.push_back(cv::Rect(rects[r].x,y,rects[r].width,std::min(bandHeight,rects[r].y+rects[r].height-y)));
+    }
+    cv::Mat visited=cv::Mat::zeros(grey.size(),CV_8UC1);
+    vector<vector<EdgeSegment> > segments_omp(omp_get_max_threads());
+    #pragma omp parallel for
+    for (int a=0;a<int(areas.size());a++)
+        extractEdgeSegments(grey,edgesImg,areas[a],visited,minLength,segments_omp[omp_get_thread_num()]);
+    vector<EdgeSegment> segments;
+    joinVectors(segments_omp,segments);
+    ARUCO_STATS_TOC(tick,tContours);
+    ARUCO_STATS_ADD(nContours,segments.size());
+
+    ///join the collinear segments separated by a gap. The original ones are kept, since the gap might also be the separation between
+    ///the sides of two neighbour markers. Only the segments whose start is near the end of the other one are compared: the distance
+    ///between them is at most the gap plus the distance to the line, i.e., 4+0.5*length of the longest one
+    vector<vector<int> > nearby;
+    findNearbySegments(segments,4,0.5f,nearby);
+    vector<vector<EdgeSegment> > joined_omp(omp_get_max_threads());
+    #pragma omp parallel for
+    for (int i=0;i<int(segments.size());i++)
     {
+        const EdgeSegment &a=segments[i];
+        for (size_t n=0;n<nearby[i].size();n++)
+        {
+            int j=nearby[i][n];
+            const EdgeSegment &b=segments[j];
+            if (j==i || a.dir.dot(b.dir)<0.995f) continue;
+            float gap=(b.p0-a.p1).dot(a.dir);
+            if (gap<-2 || gap>0.5f*std::max(a.length,b.length)) continue;
+            if (fabs(cross2(a.dir,b.p0-a.p1))>2 || fabs(cross2(a.dir,b.p1-a.p1))>2) continue;
+            EdgeSegment seg;
+            seg.p0=a.p0;
+            seg.p1=b.p1;
+            seg.length=sqrt((seg.p1-seg.p0).dot(seg.p1-seg.p0));
+            seg.dir=(seg.p1-seg.p0)*(1.f/seg.length);
+            joined_omp[omp_get_thread_num()].push_back(seg);
+        }
+    }
+    joinVectors(joined_omp,segments);
 
+    ///link the end of each segment with the start of the segments that can be the next side of a quadrilateral dark inside,
+    ///i.e., turning in the same direction. The lines must meet near the end of the first and the start of the second, so
+    ///these are at most 2*(2+0.3*length of the longest one) apart
+    findNearbySegments(segments,4,0.6f,nearby);
+    vector<vector<SegmentLink> > links(segments.size());
+    #pragma omp parallel for
+    for (int i=0;i<int(segments.size());i++)
+    {
+        const EdgeSegment &a=segments[i];
+        for (size_t n=0;n<nearby[i].size();n++)
+        {
+            int j=nearby[i][n];
+            const EdgeSegment &b=segments[j];
+            float sinAngle=cross2(a.dir,b.dir);
+            if (sinAngle>-0.34f) continue;//turning less than 20 degrees or to the other side
+            //the lines meet in a.p1+s*a.dir == b.p0+t*b.dir
+            cv::Point2f w=b.p0-a.p1;
+            float s=cross2(w,b.dir)/sinAngle;
+            float t=-cross2(a.dir,w)/sinAngle;
+            float gapTol=2+0.3f*std::max(a.length,b.length),overlapTol=2+0.1f*std::min(a.length,b.length);
+            if (s<-overlapTol || s>gapTol || t<-gapTol || t>overlapTol) continue;
+            SegmentLink link;
+            link.to=j;
+            link.corner=a.p1+a.dir*s;
+            links[i].push_back(link);
+        }
+    }
 
-        //check it is a possible element by first checking is has enough points
-        if ( minSize< contours2[i].size() &&contours2[i].size()<maxSize  )
+    ///the quadrilaterals are the cycles of four links. Each one is found from its segment with the lowest index, and kept once
+    ///even if its segments form several cycles (the vertices sorted identify it)
+    vector<cv::Point> quad(4);
+    std::set<vector<int> > foundCycles;
+    vector<int> cycle(4);
+    for (int a=0;a<int(segments.size());a++)
+        for (size_t ab=0;ab<links[a].size();ab++)
         {
-            //approximate to a poligon
-            approxPolyDP (  contours2[i]  ,approxCurve , double ( contours2[i].size() ) *0.05 , true );
-            // 				drawApproxCurve(copy,approxCurve,Scalar(0,0,255));
-            //check that the poligon has 4 points
-            if ( approxCurve.size() ==4 )
+            int b=links[a][ab].to;
+            if (b<=a) continue;
+            for (size_t bc=0;bc<links[b].size();bc++)
             {
-
-//  	   drawContour(input,contours2[i],Scalar(255,0,225));
-//  		  namedWindow("input");
-//  		imshow("input",input);
-//  	 	waitKey(0);
-                //and is convex
-                if ( isContourConvex ( Mat ( approxCurve ) ) )
+                int c=links[b][bc].to;
+                if (c<=a || c==b) continue;
+                for (size_t cd=0;cd<links[c].size();cd++)
                 {
-// 					      drawApproxCurve(input,approxCurve,Scalar(255,0,255));
-// 						//ensure that the   distace between consecutive points is large enough
-                    float minDist=1e10;
-                    for ( int j=0;j<4;j++ )
+                    int d=links[c][cd].to;
+                    if (d<=a || d==b || d==c) continue;
+                    for (size_t da=0;da<links[d].size();da++)
                     {
-                        float d= std::sqrt ( ( float ) ( approxCurve[j].x-approxCurve[ ( j+1 ) %4].x ) * ( approxCurve[j].x-approxCurve[ ( j+1 ) %4].x ) +
-                                             ( approxCurve[j].y-approxCurve[ ( j+1 ) %4].y ) * ( approxCurve[j].y-approxCurve[ ( j+1 ) %4].y ) );
-                        // 		norm(Mat(approxCurve[i]),Mat(approxCurve[(i+1)%4]));
-                        if ( d<minDist ) minDist=d;
-                    }
-                    //check that distance is not very small
-                    if ( minDist>10 )
-                    {
-                        //add the points
-                        // 	      cout<<"ADDED"<<endl;
-                        MarkerCanditates.push_back ( MarkerCandidate() );
-                        MarkerCanditates.back().idx=i;
-                        for ( int j=0;j<4;j++ )
+                        if (links[d][da].to!=a) continue;
+                        cv::Point2f corners[4]={links[d][da].corner,links[a][ab].corner,links[b][bc].corner,links[c][cd].corner};
+                        float perim=0;
+                        for (int k=0;k<4;k++)
+                        {
+                            cv::Point2f side=corners[(k+1)%4]-corners[k];
+                            perim+=sqrt(side.dot(side));
+                            quad[k]=cv::Point(cvRound(corners[k].x),cvRound(corners[k].y));
+                        }
+                        if (perim<=minSize || perim>=maxSize)
+                        {
+                            ARUCO_STATS_ADD(nRejected[FILTER_CONTOUR_SIZE],1);
+                            continue;
+                        }
+                        int rejectedBy=applyCandidateFilters(quad,grey.size());
+                        if ( rejectedBy!=-1 )
                         {
-                            MarkerCanditates.back().push_back ( Point2f ( approxCurve[j].x,approxCurve[j].y ) );
+                            ARUCO_STATS_ADD(nRejected[rejectedBy],1);
+                            continue;
                         }
+                        cycle[0]=a;cycle[1]=b;cycle[2]=c;cycle[3]=d;
+                        std::sort(cycle.begin(),cycle.end());
+                        if (!foundCycles.insert(cycle).second) continue;
+                        MarkerCanditates.push_back ( MarkerCandidate() );
+                        //sorted in anti-clockwise order, as in detectRectangles
+                        MarkerCanditates.back().push_back(corners[0]);
+                        if ( cross2(corners[1]-corners[0],corners[2]-corners[0]) <0 )
+                            for (int k=3;k>=1;k--) MarkerCanditates.back().push_back(corners[k]);
+                        else
+                            for (int k=1;k<4;k++) MarkerCanditates.back().push_back(corners[k]);
                     }
                 }
             }
         }
-    }
-
-// 		 		  namedWindow("input");
-//  		imshow("input",input);
-//  						waitKey(0);
-    ///sort the points in anti-clockwise order
-    valarray<bool> swapped(false,MarkerCanditates.size());//used later
-    for ( unsigned int i=0;i<MarkerCanditates.size();i++ )
-    {
+    ARUCO_STATS_TOC(tick,tQuadFilter);
 
-        //trace a line between the first and second point.
-        //if the thrid point is at the right side, then the points are anti-clockwise
-        double dx1 = MarkerCanditates[i][1].x - MarkerCanditates[i][0].x;
-        double dy1 =  MarkerCanditates[i][1].y - MarkerCanditates[i][0].y;
-        double dx2 = MarkerCanditates[i][2].x - MarkerCanditates[i][0].x;
-        double dy2 = MarkerCanditates[i][2].y - MarkerCanditates[i][0].y;
-        double o = ( dx1*dy2 )- ( dy1*dx2 );
+    //the same quadrilateral may be found with a joined segment and without it
+    removeRepeatedCandidates(MarkerCanditates,OutMarkerCanditates);
+}
 
-        if ( o  < 0.0 )		 //if the third point is in the left side, then sort in anti-clockwise order
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+int MarkerDetector::applyCandidateFilters(const vector<Point> &quad,cv::Size imSize)const
+{
+    for (size_t f=0;f<_candidateFilters.size();f++)
+    {
+        switch (_candidateFilters[f])
         {
-            swap ( MarkerCanditates[i][1],MarkerCanditates[i][3] );
-            swapped[i]=true;
-            //sort the contour points
-//  	    reverse(MarkerCanditates[i].contour.begin(),MarkerCanditates[i].contour.end());//????
-
+        case FILTER_BORDER:
+        {
+            //any of the corners is too near image border
+            float borderDistThresX=_borderDistThres*float(imSize.width);
+            float borderDistThresY=_borderDistThres*float(imSize.height);
+            for ( int c=0;c<4;c++ )
+                if ( quad[c].x<borderDistThresX || quad[c].y<borderDistThresY ||
+                        quad[c].x>imSize.width-borderDistThresX || quad[c].y>imSize.height-borderDistThresY ) return FILTER_BORDER;
+        }
+        break;
+        case FILTER_MIN_SIDE:
+        {
+            //ensure that the   distace between consecutive points is large enough (compared squared)
+            float minDist2=_minSideLength*_minSideLength;
+            for ( int j=0;j<4;j++ )
+            {
+                float dx=quad[j].x-quad[ ( j+1 ) %4].x, dy=quad[j].y-quad[ ( j+1 ) %4].y;
+                if ( dx*dx+dy*dy<=minDist2 ) return FILTER_MIN_SIDE;
+            }
+        }
+        break;
+        case FILTER_AREA:
+        {
+            if ( _minArea<=0 && _maxArea>=1 ) break;
+            //shoelace formula
+            float area=0;
+            for ( int j=0;j<4;j++ )
+                area+=float(quad[j].x)*float(quad[ ( j+1 ) %4].y)-float(quad[ ( j+1 ) %4].x)*float(quad[j].y);
+            area=fabs(area)*0.5f/ ( float(imSize.width)*float(imSize.height) );
+            if ( area<_minArea || area>_maxArea ) return FILTER_AREA;
+        }
+        break;
+        case FILTER_ASPECT:
+        {
+            if ( _maxAspectRatio<=0 ) break;
+            float minSide2=std::numeric_limits<float>::max(),maxSide2=0;
+            for ( int j=0;j<4;j++ )
+            {
+                float dx=quad[j].x-quad[ ( j+1 ) %4].x, dy=quad[j].y-quad[ ( j+1 ) %4].y;
+                float d2=dx*dx+dy*dy;
+                minSide2=std::min(minSide2,d2);
+                maxSide2=std::max(maxSide2,d2);
+            }
+            if ( maxSide2>_maxAspectRatio*_maxAspectRatio*minSide2 ) return FILTER_ASPECT;
         }
+        break;
+        case FILTER_CONVEX:
+            if ( !isContourConvex ( Mat ( quad ) ) ) return FILTER_CONVEX;
+            break;
+        default:
+            break;
+        };
     }
-      
-    /// remove these elements which corners are too close to each other
+    return -1;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerDetector::removeTooNearCandidates(vector<MarkerCandidate> &MarkerCanditates,vector<bool> &toRemove)
+{
     //first detect candidates to be removed
- 
     vector< vector<pair<int,int>  > > TooNearCandidates_omp(omp_get_max_threads());
     #pragma omp parallel for
-    for ( unsigned int i=0;i<MarkerCanditates.size();i++ )
+    for ( int i=0;i<int(MarkerCanditates.size());i++ )
     {
-        // 	cout<<"Marker i="<<i<<MarkerCanditates[i]<<endl;
         //calculate the average distance of each corner to the nearest corner of the other marker candidate
         for ( unsigned int j=i+1;j<MarkerCanditates.size();j++ )
         {
@@ -399,30 +1970,16 @@ void MarkerDetector::detectRectangles(const cv::Mat &thresImg,vector<MarkerCandi
         }
     }
     //join
-     vector<pair<int,int>  > TooNearCandidates;
-     joinVectors(  TooNearCandidates_omp,TooNearCandidates);
+    vector<pair<int,int>  > TooNearCandidates;
+    joinVectors(  TooNearCandidates_omp,TooNearCandidates);
     //mark for removal the element of  the pair with smaller perimeter
-    valarray<bool> toRemove ( false,MarkerCanditates.size() );
+    toRemove.assign ( MarkerCanditates.size(),false );
     for ( unsigned int i=0;i<TooNearCandidates.size();i++ )
     {
         if ( perimeter ( MarkerCanditates[TooNearCandidates[i].first ] ) >perimeter ( MarkerCanditates[ TooNearCandidates[i].second] ) )
             toRemove[TooNearCandidates[i].second]=true;
         else toRemove[TooNearCandidates[i].first]=true;
     }
-
-    //remove the invalid ones
-//     removeElements ( MarkerCanditates,toRemove );
-    //finally, assign to the remaining candidates the contour
-    OutMarkerCanditates.reserve(MarkerCanditates.size());
-    for (size_t i=0;i<MarkerCanditates.size();i++) {
-        if (!toRemove[i]) {
-            OutMarkerCanditates.push_back(MarkerCanditates[i]);
-            OutMarkerCanditates.back().contour=contours2[ MarkerCanditates[i].idx];
-            if (swapped[i] )//if the corners where swapped, it is required to reverse here the points so that they are in the same order
-                reverse(OutMarkerCanditates.back().contour.begin(),OutMarkerCanditates.back().contour.end());//????
-        }
-    }
-
 }
 
 /************************************
@@ -464,6 +2021,10 @@ void MarkerDetector::thresHold ( int method,const Mat &grey,Mat &out,double para
 // 			  out=aux;
     }
     break;
+    case EDGE_SEGMENTS:
+        //the same edges, but the small holes do not matter since they are grouped in segments by detectSegmentQuads
+        cv::Canny ( grey, out, 10, 220 );
+        break;
     }
 }
 /************************************
@@ -756,22 +2317,29 @@ void MarkerDetector::findBestCornerInRegion_harris ( const cv::Mat  & grey,vecto
 }
 
 
-/**
+/************************************
  *
  *
+ *
+ *
+ ************************************/
+/**LINES refinement of a candidate, whose corners are points of its contour
  */
-void MarkerDetector::refineCandidateLines(MarkerDetector::MarkerCandidate& candidate, const cv::Mat &camMatrix, const cv::Mat &distCoeff)
+static void refineLines(Marker& candidate, const vector<Point> &contour, const LinesUndistorter &undistorter)
 {
+      int nContour=contour.size();
+      if (nContour==0 || candidate.size()!=4) return;
       // search corners on the contour vector
-      vector<unsigned int> cornerIndex;
-      cornerIndex.resize(4);
-      for(unsigned int j=0; j<candidate.contour.size(); j++) {
+      int cornerIndex[4]={-1,-1,-1,-1};
+      for(int j=0; j<nContour; j++) {
 	for(unsigned int k=0; k<4; k++) {
-	  if(candidate.contour[j].x==candidate[k].x && candidate.contour[j].y==candidate[k].y) {
+	  if(contour[j].x==candidate[k].x && contour[j].y==candidate[k].y) {
 	    cornerIndex[k] = j;
 	  }   
 	}
       } 
+      for(int k=0; k<4; k++) 
+	if (cornerIndex[k]==-1) return;
       
       // contour pixel in inverse order or not?
       bool inverse;
@@ -780,148 +2348,47 @@ void MarkerDetector::refineCandidateLines(MarkerDetector::MarkerCandidate& candi
       else if( cornerIndex[2]>cornerIndex[1] && cornerIndex[2]<cornerIndex[0] )
 	inverse = false;
       else inverse = true;
+      int inc = inverse?-1:1;
       
-     
-      // get pixel vector for each line of the marker
-      int inc = 1;
-      if(inverse) inc = -1;
-      
-      // undistort contour
-      vector<Point2f> contour2f;
-      for(unsigned int i=0; i<candidate.contour.size(); i++) 
-	contour2f.push_back( cv::Point2f(candidate.contour[i].x, candidate.contour[i].y) );      
-      if(!camMatrix.empty() && !distCoeff.empty())
-	cv::undistortPoints(contour2f, contour2f, camMatrix, distCoeff, cv::Mat(), camMatrix); 
-
-
-      vector<std::vector<cv::Point2f> > contourLines;
-      contourLines.resize(4);
-      for(unsigned int l=0; l<4; l++) {
-	for(int j=(int)cornerIndex[l]; j!=(int)cornerIndex[(l+1)%4]; j+=inc) {
-	  if(j==(int)candidate.contour.size() && !inverse) j=0;
-	  else if(j==0 && inverse) j=candidate.contour.size()-1;
-	  contourLines[l].push_back(contour2f[j]);
-	  if(j==(int)cornerIndex[(l+1)%4]) break; // this has to be added because of the previous ifs
+      // fit a line to the (undistorted) contour pixels of each side of the marker
+      bool undistort=undistorter.isValid();
+      cv::Point3d lines[4];
+      for(int l=0; l<4; l++) {
+	LineFitter fitter;
+	for(int j=cornerIndex[l]; j!=cornerIndex[(l+1)%4]; j=(j+inc+nContour)%nContour) {
+	  cv::Point2f p(contour[j].x, contour[j].y);
+	  fitter.add( undistort?undistorter.undistort(p):p );
 	}
-	
+	if (!fitter.fit(lines[l])) return;
       }
 
-      // interpolate marker lines
-      vector<Point3f> lines;
-      lines.resize(4);
-      for(unsigned int j=0; j<lines.size(); j++) interpolate2Dline(contourLines[j], lines[j]);    
-      
-      // get cross points of lines
-      vector<Point2f> crossPoints;
-      crossPoints.resize(4);
-      for(unsigned int i=0; i<4; i++)
-	crossPoints[i] = getCrossPoint( lines[(i-1)%4], lines[i] );
-      
-      // distort corners again if undistortion was performed
-      if(!camMatrix.empty() && !distCoeff.empty())
-	  distortPoints(crossPoints, crossPoints, camMatrix, distCoeff);
+      // get cross points of consecutive lines, and distort them again if undistortion was performed
+      cv::Point2f crossPoints[4];
+      for(int i=0; i<4; i++) {
+	const cv::Point3d &l1=lines[(i+3)%4],&l2=lines[i];
+	double det=l1.x*l2.y-l2.x*l1.y;
+	if (fabs(det)<1e-9) return;//parallel lines
+	crossPoints[i]=cv::Point2f( (l1.y*l2.z-l2.y*l1.z)/det, (l2.x*l1.z-l1.x*l2.z)/det );
+	if (undistort) crossPoints[i]=undistorter.distort(crossPoints[i]);
+      }
       
       // reassing points
-      for(unsigned int j=0; j<4; j++)
+      for(int j=0; j<4; j++)
 	candidate[j] = crossPoints[j];  
 }
 
-
-/**
- */
-void MarkerDetector::interpolate2Dline( const std::vector< Point2f >& inPoints, Point3f& outLine)
-{
-  
-  float minX, maxX, minY, maxY;
-  minX = maxX = inPoints[0].x;
-  minY = maxY = inPoints[0].y;
-  for(unsigned int i=1; i<inPoints.size(); i++)  {
-    if(inPoints[i].x < minX) minX = inPoints[i].x;
-    if(inPoints[i].x > maxX) maxX = inPoints[i].x;
-    if(inPoints[i].y < minY) minY = inPoints[i].y;
-    if(inPoints[i].y > maxY) maxY = inPoints[i].y;
-  }
-
-    // create matrices of equation system
-    Mat A(inPoints.size(),2,CV_32FC1, Scalar(0));
-    Mat B(inPoints.size(),1,CV_32FC1, Scalar(0));
-    Mat X;
-
-    
-    
-    if( maxX-minX > maxY-minY ) {
-      // Ax + C = y
-      for (int i=0; i<inPoints.size(); i++) {
-
-	  A.at<float>(i, 0) = inPoints[i].x;
-	  A.at<float>(i, 1) = 1.;
-	  B.at<float>(i, 0) = inPoints[i].y;
-
-      }
-
-      // solve system
-      solve(A,B,X, DECOMP_SVD);
-      // return Ax + By + C
-      outLine = Point3f(X.at<float>(0,0), -1., X.at<float>(1,0));  
-    }
-    else {
-      // By + C = x
-      for (int i=0; i<inPoints.size(); i++) {
-
-	  A.at<float>(i, 0) = inPoints[i].y;
-	  A.at<float>(i, 1) = 1.;
-	  B.at<float>(i, 0) = inPoints[i].x;
-
-      }
-
-      // solve system
-      solve(A,B,X, DECOMP_SVD);
-      // return Ax + By + C
-      outLine = Point3f(-1., X.at<float>(0,0), X.at<float>(1,0));        
-    }
-  
-}
-
 /**
  */
-Point2f MarkerDetector::getCrossPoint(const cv::Point3f& line1, const cv::Point3f& line2)
+void MarkerDetector::refineCandidateLines(MarkerDetector::MarkerCandidate& candidate, const cv::Mat &camMatrix, const cv::Mat &distCoeff)
 {
-  
-    // create matrices of equation system
-    Mat A(2,2,CV_32FC1, Scalar(0));
-    Mat B(2,1,CV_32FC1, Scalar(0));
-    Mat X;
-
-    A.at<float>(0, 0) = line1.x;
-    A.at<float>(0, 1) = line1.y;
-    B.at<float>(0, 0) = -line1.z;    
-
-    A.at<float>(1, 0) = line2.x;
-    A.at<float>(1, 1) = line2.y;
-    B.at<float>(1, 0) = -line2.z; 	
-	
-    // solve system
-    solve(A,B,X, DECOMP_SVD);
-    return Point2f(X.at<float>(0,0), X.at<float>(1,0));   
-  
+    refineLines(candidate,candidate.contour,LinesUndistorter(camMatrix,distCoeff));
 }
 
-
 /**
  */
-void MarkerDetector::distortPoints(vector<cv::Point2f> in, vector<cv::Point2f> &out, const Mat& camMatrix, const Mat& distCoeff)
+void MarkerDetector::refineCandidateLines(MarkerDetector::MarkerCandidate& candidate, const CameraParameters &camParams)
 {
- 	// trivial extrinsics
- 	cv::Mat Rvec = cv::Mat(3,1,CV_32FC1, cv::Scalar::all(0));
- 	cv::Mat Tvec = Rvec.clone();
- 	// calculate 3d points and then reproject, so opencv makes the distortion internally
- 	vector<cv::Point3f> cornersPoints3d;
- 	for(unsigned int i=0; i<in.size(); i++)
- 	  cornersPoints3d.push_back( cv::Point3f( 
-	      (in[i].x-camMatrix.at<float>(0,2))/camMatrix.at<float>(0,0), 	//x
-	      (in[i].y-camMatrix.at<float>(1,2))/camMatrix.at<float>(1,1), 	//y
-	      1 ) );								//z
- 	cv::projectPoints(cornersPoints3d, Rvec, Tvec, camMatrix, distCoeff, out);
+    refineLines(candidate,candidate.contour,LinesUndistorter(camParams));
 }
 
 
@@ -1027,6 +2494,398 @@ void MarkerDetector::setMinMaxSize(float min ,float max )throw(cv::Exception)
     if (min>max) throw cv::Exception(1," min>max","MarkerDetector::setMinMaxSize",__FILE__,__LINE__);
     _minSize=min;
     _maxSize=max;
+    resetChangeGate();
+}
+
+/************************************
+*
+*
+*
+*
+************************************/
+
+void MarkerDetector::setCandidateFilters(const std::vector<CandidateFilter> &filters)throw(cv::Exception)
+{
+    vector<bool> used(NUM_CANDIDATE_FILTERS,false);
+    for (size_t i=0;i<filters.size();i++) {
+        if (filters[i]<FILTER_BORDER || filters[i]>FILTER_CONVEX)
+            throw cv::Exception(1," filter can not be reordered","MarkerDetector::setCandidateFilters",__FILE__,__LINE__);
+        if (used[filters[i]]) throw cv::Exception(1," repeated filter","MarkerDetector::setCandidateFilters",__FILE__,__LINE__);
+        used[filters[i]]=true;
+    }
+    _candidateFilters=filters;
+    resetChangeGate();
+}
+
+const char * MarkerDetector::getCandidateFilterName(CandidateFilter f)
+{
+    switch (f) {
+    case FILTER_CONTOUR_SIZE: return "contourSize";
+    case FILTER_POLYGON: return "polygon";
+    case FILTER_BORDER: return "border";
+    case FILTER_MIN_SIDE: return "minSide";
+    case FILTER_AREA: return "area";
+    case FILTER_ASPECT: return "aspect";
+    case FILTER_CONVEX: return "convex";
+    case FILTER_TOO_NEAR: return "tooNear";
+    case FILTER_HOLE: return "hole";
+    default: return "unknown";
+    };
+}
+
+void MarkerDetector::setAutoScale(bool enable,float minPixelsPerBit,int gridSize)throw(cv::Exception)
+{
+    if (minPixelsPerBit<=0) throw cv::Exception(1," invalid number of pixels per bit","MarkerDetector::setAutoScale",__FILE__,__LINE__);
+    if (gridSize<3) throw cv::Exception(1," invalid grid size","MarkerDetector::setAutoScale",__FILE__,__LINE__);
+    _autoScale=enable;
+    _autoScaleMinPixelsPerBit=minPixelsPerBit;
+    _autoScaleGridSize=gridSize;
+    _observedMinSide=-1;
+    resetChangeGate();
+}
+
+void MarkerDetector::setNegativeCache(bool enable,int ttlFrames,int quantStep,int reverifyInterval)throw(cv::Exception)
+{
+    if (ttlFrames<1) throw cv::Exception(1," invalid time to live","MarkerDetector::setNegativeCache",__FILE__,__LINE__);
+    if (quantStep<1) throw cv::Exception(1," invalid quantization step","MarkerDetector::setNegativeCache",__FILE__,__LINE__);
+    if (reverifyInterval<1) throw cv::Exception(1," invalid reverification interval","MarkerDetector::setNegativeCache",__FILE__,__LINE__);
+    _negCacheEnabled=enable;
+    _negCacheTTL=ttlFrames;
+    _negCacheQuantStep=quantStep;
+    _negCacheReverify=reverifyInterval;
+    clearNegativeCache();
+    resetChangeGate();
+}
+
+void MarkerDetector::setIdentityCache(bool enable,int reverifyInterval,float tolerance,int gridSize)throw(cv::Exception)
+{
+    if (reverifyInterval<1) throw cv::Exception(1," invalid reverification interval","MarkerDetector::setIdentityCache",__FILE__,__LINE__);
+    if (tolerance<=0) throw cv::Exception(1," invalid tolerance","MarkerDetector::setIdentityCache",__FILE__,__LINE__);
+    if (gridSize<3) throw cv::Exception(1," invalid grid size","MarkerDetector::setIdentityCache",__FILE__,__LINE__);
+    _idCacheEnabled=enable;
+    _idCacheInterval=reverifyInterval;
+    _idCacheTolerance=tolerance;
+    _idCacheGridSize=gridSize;
+    _idCache.clear();
+    _idCacheHits=_idCacheMisses=0;
+    resetChangeGate();
+}
+
+void MarkerDetector::setROI(const cv::Mat &mask)throw(cv::Exception)
+{
+    if (mask.empty()) { clearROI(); return; }
+    if (mask.type()!=CV_8UC1) throw cv::Exception(9001,"mask.type()!=CV_8UC1","MarkerDetector::setROI",__FILE__,__LINE__);
+    clearROI();
+    mask.copyTo(_roiMask);
+    _roiEnabled=true;
+}
+
+void MarkerDetector::setROI(const std::vector<cv::Rect> &rects)
+{
+    clearROI();
+    _roiRects=rects;
+    _roiEnabled=true;
+}
+
+void MarkerDetector::clearROI()
+{
+    _roiEnabled=false;
+    _roiMask.release();
+    _roiRects.clear();
+    _roiLevels.clear();
+    resetChangeGate();
+}
+
+void MarkerDetector::setChangeGating(bool enable,int blockSize,float threshold,float maxPartialFraction)throw(cv::Exception)
+{
+    if (blockSize<2) throw cv::Exception(1," invalid block size","MarkerDetector::setChangeGating",__FILE__,__LINE__);
+    if (threshold<0) throw cv::Exception(1," invalid threshold","MarkerDetector::setChangeGating",__FILE__,__LINE__);
+    if (maxPartialFraction<0 || maxPartialFraction>1) throw cv::Exception(1," invalid fraction","MarkerDetector::setChangeGating",__FILE__,__LINE__);
+    _gateEnabled=enable;
+    _gateBlockSize=blockSize;
+    _gateThreshold=threshold;
+    _gateMaxPartialFraction=maxPartialFraction;
+    resetChangeGate();
+    _gateFrames=_gateSkipped=_gatePartial=0;
+}
+
+void MarkerDetector::setPrescreen(bool enable,int level,int margin,int fullFrameInterval)throw(cv::Exception)
+{
+    if (level<1) throw cv::Exception(1," invalid thumbnail level","MarkerDetector::setPrescreen",__FILE__,__LINE__);
+    if (margin<0) throw cv::Exception(1," invalid margin","MarkerDetector::setPrescreen",__FILE__,__LINE__);
+    if (fullFrameInterval<0) throw cv::Exception(1," invalid interval","MarkerDetector::setPrescreen",__FILE__,__LINE__);
+    _prescreenEnabled=enable;
+    _prescreenLevel=level;
+    _prescreenMargin=margin;
+    _prescreenInterval=fullFrameInterval;
+    _prescreenCounter=0;
+    _prescreenRegions.clear();
+    _prescreenMarkerRects.clear();
+    resetChangeGate();
+}
+
+void MarkerDetector::setThresholdAutoTuning(bool enable,int minBlockSize,int maxBlockSize,double minConstant,double maxConstant,int period)throw(cv::Exception)
+{
+    if (minBlockSize<3 || maxBlockSize<minBlockSize) throw cv::Exception(1," invalid block size limits","MarkerDetector::setThresholdAutoTuning",__FILE__,__LINE__);
+    if (maxConstant<minConstant) throw cv::Exception(1," invalid constant limits","MarkerDetector::setThresholdAutoTuning",__FILE__,__LINE__);
+    if (period<1) throw cv::Exception(1," invalid period","MarkerDetector::setThresholdAutoTuning",__FILE__,__LINE__);
+    _tuneEnabled=enable;
+    //odd block sizes only
+    _tuneMinBlock=minBlockSize|1;
+    _tuneMaxBlock=std::max(_tuneMinBlock,maxBlockSize%2==1?maxBlockSize:maxBlockSize-1);
+    _tuneMinConst=minConstant;
+    _tuneMaxConst=maxConstant;
+    _tunePeriod=period;
+    //the search starts from the current parameters
+    int block=std::min(std::max(int(_thresParam1)|1,_tuneMinBlock),_tuneMaxBlock);
+    _thresParam1=_tuneBestParam1=block;
+    _thresParam2=_tuneBestParam2=std::min(std::max(_thresParam2,_tuneMinConst),_tuneMaxConst);
+    _tuneHasScore=false;
+    _tuneDirection=-1;
+    _tuneNextDirection=0;
+    _tuneFailures=0;
+    _tuneFrames=0;
+    _tuneScoreSum=0;
+    _tuneWait=0;
+}
+
+bool MarkerDetector::setThresholdTuningNeighbour(int dir)
+{
+    //0: bigger block, 1: smaller block, 2: bigger constant, 3: smaller constant
+    double param1=_tuneBestParam1,param2=_tuneBestParam2;
+    switch (dir) {
+    case 0: param1+=2; break;
+    case 1: param1-=2; break;
+    case 2: param2+=1; break;
+    case 3: param2-=1; break;
+    };
+    //the block size is not employed in the auto scale mode
+    if (dir<2 && _autoScale) return false;
+    if (param1<_tuneMinBlock || param1>_tuneMaxBlock || param2<_tuneMinConst || param2>_tuneMaxConst) return false;
+    _thresParam1=param1;
+    _thresParam2=param2;
+    return true;
+}
+
+void MarkerDetector::updateThresholdTuning(int nMarkers,int nFailed)
+{
+    //a missed marker costs as much as this number of candidates not identified
+    const double candidatesPerMarker=20;
+    //minimum improvement of the score (markers per call) to accept a neighbour, and periods to wait once converged
+    const double hysteresis=0.2;
+    const int idlePeriods=10;
+
+    _tuneScoreSum+=nMarkers-nFailed/candidatesPerMarker;
+    if (++_tuneFrames<_tunePeriod) return;
+    double score=_tuneScoreSum/_tuneFrames;
+    _tuneFrames=0;
+    _tuneScoreSum=0;
+
+    if (_tuneDirection==-1)
+    {
+        //the best parameters were in use. If their score drops, the scene has changed and it is time to explore again
+        if (_tuneHasScore && score<_tuneBestScore-hysteresis) _tuneWait=0;
+        _tuneBestScore=score;
+        _tuneHasScore=true;
+        if (_tuneWait>0) {
+            _tuneWait--;
+            return;
+        }
+    }
+    else if (score>_tuneBestScore+hysteresis)
+    {
+        //better: it becomes the best, and the same direction is tried again
+        _tuneBestParam1=_thresParam1;
+        _tuneBestParam2=_thresParam2;
+        _tuneBestScore=score;
+        _tuneFailures=0;
+        _tuneNextDirection=_tuneDirection;
+    }
+    else
+    {
+        _tuneFailures++;
+        _tuneNextDirection=(_tuneDirection+1)%4;
+    }
+    //next neighbour to evaluate, skipping those out of the limits
+    while (_tuneFailures<4)
+    {
+        int dir=_tuneNextDirection;
+        if (setThresholdTuningNeighbour(dir)) {
+            _tuneDirection=dir;
+            return;
+        }
+        _tuneFailures++;
+        _tuneNextDirection=(dir+1)%4;
+    }
+    //no neighbour is better: back to the best parameters for a while
+    _thresParam1=_tuneBestParam1;
+    _thresParam2=_tuneBestParam2;
+    _tuneDirection=-1;
+    _tuneFailures=0;
+    _tuneWait=idlePeriods;
+}
+
+void MarkerDetector::clearNegativeCache()
+{
+    _negCache.clear();
+    _negCacheHits=_negCacheLookups=0;
+}
+
+void MarkerDetector::setMarkerDecoders(const std::vector<MarkerDecoder*> &decoders)
+{
+    _decoders=decoders;
+    for (size_t i=0;i<_decoders.size();i++) _decoders[i]->setAllowedIds(_allowedIds);
+    //the results of the previous calls might not be valid anymore
+    clearNegativeCache();
+    _idCache.clear();
+    resetChangeGate();
+}
+
+void MarkerDetector::setAllowedIds(const std::set<int> &ids)
+{
+    _allowedIds=ids;
+    for (size_t i=0;i<_decoders.size();i++) _decoders[i]->setAllowedIds(_allowedIds);
+    //the results of the previous calls might not be valid anymore
+    clearNegativeCache();
+    _idCache.clear();
+    resetChangeGate();
+}
+
+void MarkerDetector::setTimeBudget(double ms)throw(cv::Exception)
+{
+    if (ms<0) throw cv::Exception(1," negative time budget","MarkerDetector::setTimeBudget",__FILE__,__LINE__);
+    _timeBudget=ms;
+    resetChangeGate();
+}
+
+void MarkerDetector::setCandidateBudget(int n)throw(cv::Exception)
+{
+    if (n<0) throw cv::Exception(1," negative candidate budget","MarkerDetector::setCandidateBudget",__FILE__,__LINE__);
+    _candidateBudget=n;
+    updateSpeedSettings();
+}
+
+void MarkerDetector::setTargetFrameTime(double ms)throw(cv::Exception)
+{
+    if (ms<0) throw cv::Exception(1," negative target time","MarkerDetector::setTargetFrameTime",__FILE__,__LINE__);
+    //changing the target of an enabled governor keeps its level
+    if (ms==0 || _govTarget==0) _govLevel=0;
+    _govTarget=ms;
+    _govCallsOver=_govCallsSinceChange=0;
+    updateSpeedSettings();
+}
+
+MarkerDetector::SpeedSettings MarkerDetector::getActiveSpeedSettings()const
+{
+    return _activeSpeed;
+}
+
+static bool sameSpeedSettings(const MarkerDetector::SpeedSettings &a,const MarkerDetector::SpeedSettings &b)
+{
+    return a.pyrDownLevel==b.pyrDownLevel && a.warpSize==b.warpSize && a.cornerMethod==b.cornerMethod &&
+           a.trackingInterval==b.trackingInterval && a.candidateBudget==b.candidateBudget;
+}
+
+void MarkerDetector::updateSpeedSettings()
+{
+    //the settings of the user, which the governor never modifies
+    SpeedSettings settings;
+    settings.pyrDownLevel=pyrdown_level;
+    settings.warpSize=_markerWarpSize;
+    settings.cornerMethod=_cornerMethod;
+    settings.trackingInterval=1;
+    settings.candidateBudget=_candidateBudget;
+    if (_govTarget==0)
+    {
+        _govLadder.clear();
+        _govTime.clear();
+        _govLevel=0;
+        _activeSpeed=settings;
+    }
+    else
+    {
+        //the levels, from the settings of the user to the fastest ones
+        vector<SpeedSettings> ladder;
+        ladder.push_back(settings);
+        if (settings.warpSize>28) {
+            settings.warpSize=28;
+            ladder.push_back(settings);
+        }
+        if (settings.cornerMethod!=NONE) {
+            settings.cornerMethod=NONE;
+            ladder.push_back(settings);
+        }
+        for (int i=0;i<2;i++) {
+            settings.pyrDownLevel++;
+            settings.trackingInterval*=2;
+            ladder.push_back(settings);
+        }
+        for (int budget=20;budget>=10;budget/=2) {
+            if (settings.candidateBudget==0 || settings.candidateBudget>budget) settings.candidateBudget=budget;
+            settings.trackingInterval*=2;
+            ladder.push_back(settings);
+        }
+        //the times measured are only kept if the levels do not change
+        bool same= ladder.size()==_govLadder.size();
+        for (size_t i=0;same && i<ladder.size();i++) same=sameSpeedSettings(ladder[i],_govLadder[i]);
+        if (!same)
+        {
+            _govLadder=ladder;
+            _govTime.assign(_govLadder.size(),-1);
+            _govLevel=std::min(_govLevel,int(_govLadder.size())-1);
+            _govCallsOver=_govCallsSinceChange=0;
+        }
+        _activeSpeed=_govLadder[_govLevel];
+    }
+    resetChangeGate();
+}
+
+void MarkerDetector::updateSpeedGovernor(double ms)
+{
+    //weight of the last call in the average time of a level
+    const double alpha=0.2;
+    //consecutive calls over the target to move down, calls in a level before moving up, and fraction of the target that the upper
+    //level is expected to take to move up
+    const int callsToMoveDown=3,callsToMoveUp=30;
+    const double spareFraction=0.8;
+
+    double &levelTime=_govTime[_govLevel];
+    levelTime= levelTime<0 ? ms : levelTime* ( 1-alpha ) +ms*alpha;
+    _govCallsSinceChange++;
+    _govCallsOver= ms>_govTarget ? _govCallsOver+1 : 0;
+    int newLevel=_govLevel;
+    if (_govCallsOver>=callsToMoveDown && _govLevel+1<int(_govLadder.size())) newLevel=_govLevel+1;
+    else if (_govLevel>0 && _govCallsSinceChange>=callsToMoveUp)
+    {
+        //the time of the upper level is forgotten after a long time, since the scene may have changed
+        double upperTime= _govCallsSinceChange<10*callsToMoveUp ? _govTime[_govLevel-1] : -1;
+        if ( (upperTime>=0 && upperTime<spareFraction*_govTarget) || (upperTime<0 && levelTime<0.5*_govTarget) ) newLevel=_govLevel-1;
+    }
+    if (newLevel!=_govLevel)
+    {
+        _govLevel=newLevel;
+        _activeSpeed=_govLadder[_govLevel];
+        _govCallsOver=_govCallsSinceChange=0;
+        //the result of the last frame was obtained with the settings of another level
+        resetChangeGate();
+    }
+}
+
+void MarkerDetector::setAreaLimits(float minArea,float maxArea)throw(cv::Exception)
+{
+    if (minArea<0 || minArea>1) throw cv::Exception(1," minArea parameter out of range","MarkerDetector::setAreaLimits",__FILE__,__LINE__);
+    if (maxArea<=0 || maxArea>1) throw cv::Exception(1," maxArea parameter out of range","MarkerDetector::setAreaLimits",__FILE__,__LINE__);
+    if (minArea>maxArea) throw cv::Exception(1," minArea>maxArea","MarkerDetector::setAreaLimits",__FILE__,__LINE__);
+    _minArea=minArea;
+    _maxArea=maxArea;
+    resetChangeGate();
+}
+
+void MarkerDetector::setBorderDistance(float val)throw(cv::Exception)
+{
+    if (val<0 || val>=0.5) throw cv::Exception(1," border distance out of range","MarkerDetector::setBorderDistance",__FILE__,__LINE__);
+    _borderDistThres=val;
+    resetChangeGate();
 }
 
 /************************************
@@ -1040,6 +2899,7 @@ void MarkerDetector::setWarpSize(int val) throw(cv::Exception)
 {
   if (val<10) throw cv::Exception(1," invalid canonical image size","MarkerDetector::setWarpSize",__FILE__,__LINE__);
   _markerWarpSize = val;
+  updateSpeedSettings();
 }
 
 
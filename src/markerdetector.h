@@ -30,10 +30,14 @@ or implied, of Rafael Muñoz Salinas.
 #include <opencv2/core/core.hpp>
 #include <cstdio>
 #include <iostream>
+#include <map>
+#include <set>
 #include "cameraparameters.h"
 #include "exports.h"
 #include "marker.h"
+#include "markerdecoder.h"
 #include "hammingcode.h"
+#include "imagepyramid.h"
 using namespace std;
 
 namespace aruco
@@ -44,6 +48,8 @@ namespace aruco
  */
 class ARUCO_EXPORTS  MarkerDetector
 {
+  //the internal kernels are measured in isolation by utils_bench/aruco_microbench
+  friend class MarkerDetectorBenchAccess;
   //Represent a candidate to be a maker
   class MarkerCandidate : public Marker{
   public:
@@ -96,12 +102,22 @@ public:
      * @param markerSizeMeters size of the marker sides expressed in meters
      * @param setYPerperdicular If set the Y axis will be perpendicular to the surface. Otherwise, it will be the Z axis
      */
-    void detect(const cv::Mat &input,std::vector<Marker> &detectedMarkers, CameraParameters camParams,float markerSizeMeters=-1,bool setYPerperdicular=false) throw (cv::Exception);
+    void detect(const cv::Mat &input,std::vector<Marker> &detectedMarkers,const CameraParameters &camParams,float markerSizeMeters=-1,bool setYPerperdicular=false) throw (cv::Exception);
+    /**Same as above, but the grey image and its reduced versions (see pyrDown) are taken from a pyramid already built,
+     * for instance, by a MarkerTracker
+     *
+     * @param pyramid pyramid of the grey input image. Level 0 is employed as input image. If it has not enough levels, the missing ones are computed
+     */
+    void detect(const ImagePyramid &pyramid,std::vector<Marker> &detectedMarkers,const CameraParameters &camParams,float markerSizeMeters=-1,bool setYPerperdicular=false) throw (cv::Exception);
 
     /**This set the type of thresholding methods available
+     * EDGE_SEGMENTS does not look for closed contours in the thresholded image. Instead, its edges are grouped in straight segments
+     * that are linked into quadrilaterals (see detectSegmentQuads), so that markers whose border is partially occluded are still found.
+     * Erosion is not applied with this method. The corners obtained are the intersections of the lines of the sides,
+     * so that the LINES refinement has no effect on them
      */
 
-    enum ThresholdMethods {FIXED_THRES,ADPT_THRES,CANNY};
+    enum ThresholdMethods {FIXED_THRES,ADPT_THRES,CANNY,EDGE_SEGMENTS};
 
 
 
@@ -109,6 +125,7 @@ public:
      */
     void setThresholdMethod(ThresholdMethods m) {
         _thresMethod=m;
+        resetChangeGate();
     }
     /**Returns the current threshold method
      */
@@ -124,6 +141,7 @@ public:
     void setThresholdParams(double param1,double param2) {
         _thresParam1=param1;
         _thresParam2=param2;
+        resetChangeGate();
     }
     /**
      * Set the parameters of the threshold method
@@ -135,6 +153,39 @@ public:
         param1=_thresParam1;
         param2=_thresParam2;
     }
+    /**Sets several pairs of threshold parameters (param1,param2) to be employed in each call to detect, for instance, under uneven lighting.
+     * The image is thresholded with each pair (in parallel) and the candidates found in all the thresholded images are merged,
+     * removing the repeated ones, before identifying them. Thus, each marker is identified once.
+     * It is only employed with FIXED_THRES and ADPT_THRES. With ADPT_THRES, the means of the blocks of all the sizes are obtained
+     * from the same integral image. An empty list (default) employs the parameters of setThresholdParams.
+     * The image returned by getThresholdedImage is the one obtained with the first pair.
+     */
+    void setThresholdParamsList(const std::vector<std::pair<double,double> > &params) {
+        _thresParamsList=params;
+        resetChangeGate();
+    }
+    /**
+     */
+    const std::vector<std::pair<double,double> > & getThresholdParamsList()const {
+        return _thresParamsList;
+    }
+    /**Enables/Disables the automatic tuning of the parameters of ADPT_THRES (block size and constant, see setThresholdParams) between calls to detect.
+     * The parameters in use are evaluated during period calls, scoring each one by the number of markers detected minus a small penalty for
+     * each candidate that is not identified. Then, a neighbour pair (block size +-2 or constant +-1) is evaluated, and kept only if its score is
+     * better by a margin (hysteresis). When no neighbour improves, the parameters are kept for a while before exploring again, unless the score
+     * of the current ones drops. The search starts from the current parameters and never leaves the limits given.
+     * The parameters chosen are returned by getThresholdParams. Calls processing only part of the image (change gating, time budget) are not
+     * employed for the evaluation. In the auto scale mode, only the constant is tuned since the block size is given by the size of the bits.
+     * It is not employed with setThresholdParamsList.
+     * @param period number of calls to detect in which each pair of parameters is evaluated
+     */
+    void setThresholdAutoTuning(bool enable,int minBlockSize=3,int maxBlockSize=31,double minConstant=2,double maxConstant=15,int period=5)throw(cv::Exception);
+    /**
+     */
+    bool isThresholdAutoTuningEnabled()const{return _tuneEnabled;}
+    /**Indicates whether the automatic tuning found no better neighbour for the current parameters, and is waiting before exploring again
+     */
+    bool isThresholdAutoTuningConverged()const{return _tuneEnabled && _tuneDirection==-1 && _tuneWait>0;}
 
 
     /**Returns a reference to the internal image thresholded. It is for visualization purposes and to adjust manually
@@ -150,6 +201,7 @@ public:
      */
     void setCornerRefinementMethod(CornerRefinementMethod method) {
         _cornerMethod=method;
+        updateSpeedSettings();
     }
     /**
      */
@@ -170,11 +222,75 @@ public:
      * 
      */
     void getMinMaxSize(float &min,float &max){min=_minSize;max=_maxSize;}
+
+    /**Tests applied to the contours of the thresholded image to decide if they are candidates to be markers.
+     * FILTER_CONTOUR_SIZE (see setMinMaxSize) and FILTER_POLYGON (approximation to a 4 vertex polygon) are always applied first, and
+     * FILTER_TOO_NEAR (removal of candidates whose corners are too near to these of a bigger one) is always applied last.
+     * The rest are applied on the 4 vertex polygon in the order indicated by setCandidateFilters:
+     * FILTER_BORDER: any corner nearer to the image limits than setBorderDistance
+     * FILTER_MIN_SIDE: any side shorter than setMinSideLength
+     * FILTER_AREA: area out of the limits indicated by setAreaLimits
+     * FILTER_ASPECT: ratio between the longest and the shortest side above setMaxAspectRatio
+     * FILTER_CONVEX: the polygon is not convex
+     * FILTER_HOLE is not a filter on the polygon but counts the contours discarded before any other test in CONTOURS_HIERARCHY mode (see setContourMode)
+     */
+    enum CandidateFilter {FILTER_CONTOUR_SIZE,FILTER_POLYGON,FILTER_BORDER,FILTER_MIN_SIDE,FILTER_AREA,FILTER_ASPECT,FILTER_CONVEX,FILTER_TOO_NEAR,FILTER_HOLE,NUM_CANDIDATE_FILTERS};
+    /**Sets the filters applied to the 4 vertex polygons and their order. Only FILTER_BORDER,FILTER_MIN_SIDE,FILTER_AREA,FILTER_ASPECT and FILTER_CONVEX
+     * are allowed, and each of them at most once. Filters not in the list are not applied.
+     * By default, all of them are applied from the cheapest to the most expensive one: BORDER,MIN_SIDE,AREA,ASPECT,CONVEX
+     */
+    void setCandidateFilters(const std::vector<CandidateFilter> &filters)throw(cv::Exception);
+    /**
+     */
+    const std::vector<CandidateFilter> & getCandidateFilters()const{return _candidateFilters;}
+    /**Returns a printable name of the filter
+     */
+    static const char * getCandidateFilterName(CandidateFilter f);
+    /**Sets the minimum length in pixels (of the thresholded image) of the sides of a candidate. Default value is 10.
+     */
+    void setMinSideLength(float val){_minSideLength=val;resetChangeGate();}
+    /**
+     */
+    float getMinSideLength()const{return _minSideLength;}
+    /**Sets the minimum and maximum area of a candidate as a fraction of the image area.
+     * Default values are 0 and 1, i.e., no limits
+     */
+    void setAreaLimits(float minArea,float maxArea)throw(cv::Exception);
+    /**
+     */
+    void getAreaLimits(float &minArea,float &maxArea)const{minArea=_minArea;maxArea=_maxArea;}
+    /**Sets the maximum ratio between the longest and the shortest sides of a candidate. A value of 0 (default) disables the limit.
+     */
+    void setMaxAspectRatio(float val){_maxAspectRatio=val;resetChangeGate();}
+    /**
+     */
+    float getMaxAspectRatio()const{return _maxAspectRatio;}
+    /**Sets the border around the image limits, as a fraction of the image size, in which corners are not allowed. Default value is 0.01
+     */
+    void setBorderDistance(float val)throw(cv::Exception);
+    /**
+     */
+    float getBorderDistance()const{return _borderDistThres;}
     
     /**Enables/Disables erosion process that is REQUIRED for chessboard like boards.
      * By default, this property is enabled
      */
-    void enableErosion(bool enable){_doErosion=enable;}
+    void enableErosion(bool enable){_doErosion=enable;resetChangeGate();}
+
+    /**Contour retrieval modes.
+     * CONTOURS_LIST: all the contours of the thresholded image are analyzed. The outer and inner edges of the black border of a marker are
+     * both found, and the resulting duplicate is removed later by comparing the corners of all the candidates (FILTER_TOO_NEAR).
+     * CONTOURS_HIERARCHY: the nesting of the contours is employed so that only the outer boundary of each dark region
+     * is analyzed, and the boundaries of the holes inside them are discarded (counted as FILTER_HOLE). Each marker
+     * gives a single candidate, so that the FILTER_TOO_NEAR pass is not applied.
+     */
+    enum ContourMode {CONTOURS_LIST,CONTOURS_HIERARCHY};
+    /**Sets the contour retrieval mode. Default value is CONTOURS_LIST
+     */
+    void setContourMode(ContourMode mode){_contourMode=mode;resetChangeGate();}
+    /**
+     */
+    ContourMode getContourMode()const{return _contourMode;}
 
     /**
      * Specifies a value to indicate the required speed for the internal processes. If you need maximum speed (at the cost of a lower detection rate),
@@ -214,11 +330,37 @@ public:
      * As output your marker function must indicate the following information. First, the output parameter nRotations must indicate how many times the marker
      * must be rotated clockwise 90 deg  to be in its ideal position. (The way you would see it when you print it). This is employed to know
      * always which is the corner that acts as reference system. Second, the function must return -1 if the image does not contains one of your markers, and its id otherwise.
-     *
+     * The negative and identity caches are cleared.
      */
     void setMakerDetectorFunction(int (* markerdetector_func)(const cv::Mat &in,int &nRotations) ) {
         markerIdDetector_ptrfunc=markerdetector_func;
+        //the results of the previous calls might not be valid anymore
+        clearNegativeCache();
+        _idCache.clear();
+        resetChangeGate();
     }
+    /**
+     * Sets a list of decoders that are tried, in order, on each candidate until one of them identifies it. Thus, markers of several
+     * dictionaries can be detected in a single call. The canonical image of each candidate is sampled once, and the grid of cells
+     * is shared by all the decoders (see MarkerSample). Each marker detected is tagged with the name of the decoder that identified it
+     * (Marker::dictionary), and markers of different dictionaries with the same id are not considered duplicated.
+     * The decoders are not owned by this object, so they must remain valid while employed.
+     * If the list is empty (default), the function set in setMakerDetectorFunction is employed instead.
+     * The set of allowed ids (see setAllowedIds) is passed to the decoders. The negative and identity caches are cleared.
+     */
+    void setMarkerDecoders(const std::vector<MarkerDecoder*> &decoders);
+    /**Returns the list of decoders employed
+     */
+    const std::vector<MarkerDecoder*> & getMarkerDecoders()const{return _decoders;}
+    /**Sets the ids of the markers to detect (all if empty). The candidates whose code is not in the set are rejected during the identification,
+     * so that no corner refinement nor pose estimation is done for them. The set is passed to the decoders (see setMarkerDecoders), which can reject the codes
+     * earlier (e.g., HRMDecoder only corrects errors towards the codes in the set).
+     * The caches of identified and rejected candidates are cleared
+     */
+    void setAllowedIds(const std::set<int> &ids);
+    /**Returns the set of allowed ids (empty if all are allowed)
+     */
+    const std::set<int> & getAllowedIds()const{return _allowedIds;}
 
     /** Use an smaller version of the input image for marker detection. 
      * If your marker is small enough, you can employ an smaller image to perform the detection without noticeable reduction in the precision.
@@ -226,7 +368,246 @@ public:
      * 
      * @param level number of times the image size is divided by 2. Internally, we are performing a pyrdown.
      */
-    void pyrDown(unsigned int level){pyrdown_level=level;}
+    void pyrDown(unsigned int level){pyrdown_level=level;updateSpeedSettings();}
+    /**Returns the level of image reduction
+     */
+    int getPyrDownLevel()const{return pyrdown_level;}
+    /**Enables/Disables the automatic selection of the level of image reduction, that replaces the value set in pyrDown.
+     * In each call to detect, the coarsest level at which the smallest marker expected still has minPixelsPerBit pixels per bit
+     * is employed. The smallest marker expected is given by setMinMaxSize, or by the markers detected in the previous call
+     * if they are all bigger. The window of the adaptive threshold is adjusted to the size of the bits at the level selected.
+     * @param minPixelsPerBit minimum number of pixels per bit at the level employed
+     * @param gridSize number of bits in each direction of the markers, including the black border (7 for the default markers)
+     */
+    void setAutoScale(bool enable,float minPixelsPerBit=2,int gridSize=7)throw(cv::Exception);
+    /**
+     */
+    bool isAutoScaleEnabled()const{return _autoScale;}
+    /**Returns the level of image reduction employed in the last call to detect
+     */
+    int getLastPyrDownLevel()const{return _autoScaleLevel;}
+    /**Returns the highest level of image reduction that detect may employ (pyrDown, or the limit of the auto scale mode)
+     */
+    int getMaxPyrDownLevel()const{return _autoScale?_autoScaleMaxLevel:_activeSpeed.pyrDownLevel;}
+    /**Enables/Disables the refinement of the corners in the intermediate levels of the pyramid, from the one employed
+     * for detection (see pyrDown) to the original image. Only employed with the SUBPIX method. Enabled by default
+     */
+    void enableCoarseToFineRefinement(bool enable){_coarseToFine=enable;resetChangeGate();}
+    /**
+     */
+    bool isCoarseToFineRefinementEnabled()const{return _coarseToFine;}
+    /**Returns the pyramid of the grey image built in the last call to detect, so that it can be reused
+     * by other components (BoardDetector, ChromaticMask, MarkerTracker...). Levels are computed only up to the one
+     * indicated in pyrDown. Not updated by detect calls that receive the pyramid.
+     */
+    const ImagePyramid & getImagePyramid()const{return _pyramid;}
+
+    /**Sets a time budget in milliseconds for each call to detect. 0 (default) means no limit.
+     * When set, the candidates are identified in order of priority (see setCandidatePriority), and the identification and
+     * corner refinement stop as soon as the budget is spent. The markers found until then are returned and the detection
+     * is flagged as partial (see isLastDetectionPartial). Thresholding and contour extraction are always completed, so the
+     * budget must be large enough for them.
+     */
+    void setTimeBudget(double ms)throw(cv::Exception);
+    /**
+     */
+    double getTimeBudget()const{return _timeBudget;}
+    /**Criteria to order the candidates when a time budget is set.
+     * PRIORITY_SIZE: bigger candidates first
+     * PRIORITY_TRACKED: candidates nearer to the markers detected in the previous call first (bigger first if none was detected)
+     * PRIORITY_CONTRAST: candidates with a higher contrast between their border and the outside first
+     */
+    enum CandidatePriority {PRIORITY_SIZE,PRIORITY_TRACKED,PRIORITY_CONTRAST};
+    /**
+     */
+    void setCandidatePriority(CandidatePriority p){_candidatePriority=p;resetChangeGate();}
+    /**
+     */
+    CandidatePriority getCandidatePriority()const{return _candidatePriority;}
+    /**Indicates whether the last call to detect ran out of its time budget (or its candidate budget), so that some candidates were not identified
+     * or some markers were not refined
+     */
+    bool isLastDetectionPartial()const{return _partialDetection;}
+    /**Number of candidates not analyzed in the last call to detect because the time budget (or the candidate budget) was spent
+     */
+    int getNumSkippedCandidates()const{return int(_skippedCandidates.size());}
+    /**Returns the candidates not analyzed in the last call to detect because the time budget (or the candidate budget) was spent
+     */
+    const vector<std::vector<cv::Point2f> > &getSkippedCandidates()const{return _skippedCandidates;}
+    /**Sets the maximum number of candidates identified in each call to detect. 0 (default) means no limit.
+     * As with the time budget, the candidates are identified in order of priority (see setCandidatePriority), and
+     * the rest are skipped, flagging the detection as partial
+     */
+    void setCandidateBudget(int n)throw(cv::Exception);
+    /**
+     */
+    int getCandidateBudget()const{return _candidateBudget;}
+
+    /**Settings of the pipeline changed by the speed governor (see setTargetFrameTime)
+     */
+    struct SpeedSettings {
+        int pyrDownLevel;//level of image reduction (see pyrDown). In the auto scale mode, its difference with the first level of the governor is added to the level selected
+        int warpSize;//size of the canonical marker image (see setWarpSize)
+        CornerRefinementMethod cornerMethod;//see setCornerRefinementMethod
+        int trackingInterval;//factor applied to the redetection interval of a MarkerTracker employing this detector
+        int candidateBudget;//see setCandidateBudget
+    };
+    /**Enables the speed governor, that changes the settings of the pipeline at runtime so that each call to detect takes at most about ms milliseconds.
+     * The settings are taken from a ladder of levels of decreasing quality, the first one being the settings of the user (pyrDown, setWarpSize,
+     * setCornerRefinementMethod and setCandidateBudget). The governor never modifies these, and the ladder is rebuilt when they change.
+     * The following ones employ a smaller canonical image, no corner refinement, reduced images with longer tracking intervals, and finally
+     * a limit in the number of candidates identified. The governor moves one level down when several consecutive calls exceed the target,
+     * and one level up, after a number of calls in the current one, when the time measured in the upper level (or the current one, if it is not known)
+     * leaves spare time. Calls that do not process the image (see setChangeGating) are not measured.
+     * A value of 0 (default) disables it, so that the settings of the user are employed again.
+     */
+    void setTargetFrameTime(double ms)throw(cv::Exception);
+    /**
+     */
+    double getTargetFrameTime()const{return _govTarget;}
+    /**Returns the level of the speed governor in use. 0 is the highest quality
+     */
+    int getSpeedLevel()const{return _govLevel;}
+    /**Returns the number of levels of the speed governor (0 if it is disabled)
+     */
+    int getNumSpeedLevels()const{return int(_govLadder.size());}
+    /**Returns the settings in use. If the speed governor is enabled, these of its current level
+     */
+    SpeedSettings getActiveSpeedSettings()const;
+
+    /**Enables/Disables the cache of rejected candidates. When enabled, the candidates that are not identified as markers are
+     * remembered by the quantized location of their corners and a small hash of their appearance, and the candidates matching one
+     * of them in the following ttlFrames calls to detect are not warped nor decoded again (they are directly added to getCandidates()),
+     * except once every reverifyInterval calls. An entry is removed as soon as its candidate is identified.
+     * It is useful for static cameras viewing rectangles that are not markers (windows, labels, screens...).
+     * Note that a marker that could not be identified in a frame (e.g. because of blur) might not be detected in the following reverifyInterval-1 calls,
+     * unless it moves more than quantStep pixels.
+     * @param ttlFrames number of calls to detect during which a rejected candidate is remembered
+     * @param quantStep size in pixels of the cells in which corner locations are quantized
+     * @param reverifyInterval a remembered candidate is decoded again if not decoded in these calls
+     */
+    void setNegativeCache(bool enable,int ttlFrames=30,int quantStep=4,int reverifyInterval=5)throw(cv::Exception);
+    /**
+     */
+    bool isNegativeCacheEnabled()const{return _negCacheEnabled;}
+    /**Returns the fraction of candidates found in the cache of rejected candidates since it was enabled (or cleared)
+     */
+    double getNegativeCacheHitRate()const{return _negCacheLookups==0?0:double(_negCacheHits)/double(_negCacheLookups);}
+    /**Removes all the entries of the cache of rejected candidates and resets its hit rate
+     */
+    void clearNegativeCache();
+
+    /**Enables/Disables the cache of identified markers. When enabled, a candidate whose corners are all within tolerance pixels
+     * of the corners of a marker identified in the previous call to detect takes its id (and orientation) without being decoded,
+     * provided that a quick check of its black border succeeds. Each marker is fully decoded again at least every reverifyInterval calls.
+     * @param reverifyInterval maximum number of calls to detect between full decodings of a marker
+     * @param tolerance maximum displacement in pixels of the corners
+     * @param gridSize number of bits in each direction of the markers, including the black border (7 for the default markers)
+     */
+    void setIdentityCache(bool enable,int reverifyInterval=10,float tolerance=2,int gridSize=7)throw(cv::Exception);
+    /**
+     */
+    bool isIdentityCacheEnabled()const{return _idCacheEnabled;}
+    /**Number of candidates that took their id from the cache (hits), and that were decoded although the cache was enabled (misses),
+     * since it was enabled
+     */
+    void getIdentityCacheCounters(uint64 &hits,uint64 &misses)const{hits=_idCacheHits;misses=_idCacheMisses;}
+
+    /**Restricts the detection to the regions of the image indicated by the mask (non zero pixels), of the same size than the input
+     * images. Thresholding, contour extraction and candidate generation only process the bounding rectangles of the regions (at the
+     * level indicated in pyrDown), and the pixels out of the mask are ignored. Only the markers completely inside the regions are detected.
+     * The mask is kept until clearROI is called. An empty mask is equivalent to clearROI.
+     */
+    void setROI(const cv::Mat &mask)throw(cv::Exception);
+    /**Same as above, but the regions are given as rectangles of the input images
+     */
+    void setROI(const std::vector<cv::Rect> &rects);
+    /**Removes the regions of interest, so that the whole image is analyzed
+     */
+    void clearROI();
+    /**Indicates if a region of interest is set
+     */
+    bool hasROI()const{return _roiEnabled;}
+
+    /**Enables/Disables the detection of changes between frames, for static cameras. The mean intensity of each block of the image is
+     * compared with the one of the last frame processed. If no block changed more than threshold grey levels, detect returns the markers of
+     * the last frame without processing the image. If only a few blocks changed, only them (and the markers and candidates of the last frame
+     * that cross them) are thresholded and analyzed, and the thresholded image, markers and candidates of the rest of the image are kept.
+     * So, the cost of the detection is proportional to the motion in the scene. Otherwise, the whole image is processed.
+     * Markers are not detected again if the camera matrix or the marker size passed to detect do not change (the extrinsics are kept too).
+     * Any setter that changes the detection (parameters, filters, region of interest, decoders...) makes the next frame be fully processed.
+     * @param blockSize size in pixels of the blocks
+     * @param threshold minimum change of the mean intensity of a block to consider it changed
+     * @param maxPartialFraction maximum fraction of blocks changed to process only them
+     */
+    void setChangeGating(bool enable,int blockSize=16,float threshold=3,float maxPartialFraction=0.5)throw(cv::Exception);
+    /**
+     */
+    bool isChangeGatingEnabled()const{return _gateEnabled;}
+    /**Number of calls to detect since the change gating was enabled, and how many of them were skipped or processed partially
+     */
+    void getChangeGatingCounters(uint64 &frames,uint64 &skipped,uint64 &partial)const{frames=_gateFrames;skipped=_gateSkipped;partial=_gatePartial;}
+    /**Fraction of the calls to detect skipped because the image did not change
+     */
+    double getFrameSkipRate()const{return _gateFrames==0?0:double(_gateSkipped)/double(_gateFrames);}
+
+    /**Enables/Disables a fast pre-screening of the frames. Before the detection, a thumbnail of the image (a level of the pyramid) is
+     * thresholded coarsely and only its quadrilaterals are searched. If none is found, the frame is not processed further. Otherwise,
+     * the detection is restricted to the regions of the quadrilaterals (and of the markers of the last call), as in setROI.
+     * Markers too small to appear in the thumbnail are missed, so the whole image is processed periodically.
+     * It is not employed if a region of interest is set, or if the thumbnail is not smaller than the image employed for detection (see pyrDown)
+     * @param level level of the pyramid of the thumbnail, i.e., it is 2^level times smaller than the input image
+     * @param margin margin (in pixels of the input image) added around each region
+     * @param fullFrameInterval the whole image is processed once every these calls (0 for never)
+     */
+    void setPrescreen(bool enable,int level=3,int margin=8,int fullFrameInterval=30)throw(cv::Exception);
+    /**
+     */
+    bool isPrescreenEnabled()const{return _prescreenEnabled;}
+    /**Regions of the input image found by the pre-screening of the last call. Empty if no region was found or the pre-screening was not done
+     */
+    const std::vector<cv::Rect> & getPrescreenRegions()const{return _prescreenRegions;}
+
+    /**Timing and counters of the last call to detect.
+     * Times are wall times in milliseconds. All values are zero unless the library is compiled with
+     * ARUCO_DETECTION_STATS defined (cmake option ENABLE_DETECTION_STATS), in which case the instrumentation is compiled in.
+     */
+    struct Stats {
+        Stats(){reset();}
+        void reset(){
+            tGrey=tPyramid=tPrescreen=tThreshold=tErosion=tContours=tQuadFilter=tDuplicates=tWarpDecode=tRefinement=tPose=tTotal=0;
+            nContours=nCandidates=nDecodeAttempts=nDecoded=nDuplicatesRemoved=nNegativeCacheHits=nIdentityCacheHits=nDirtyTiles=0;
+            nPrescreenRegions=-1;
+            for(int i=0;i<NUM_CANDIDATE_FILTERS;i++) nRejected[i]=0;
+        }
+        //time employed in each stage of the detection
+        double tGrey,tPyramid,tPrescreen,tThreshold,tErosion,tContours,tQuadFilter,tDuplicates,tWarpDecode,tRefinement,tPose;
+        //time of the whole detect call
+        double tTotal;
+        //number of contours found in the thresholded image
+        int nContours;
+        //number of rectangles that are passed to the identification stage
+        int nCandidates;
+        //number of canonical images passed to the marker identification function
+        int nDecodeAttempts;
+        //candidates not decoded because they were found in the cache of rejected candidates
+        int nNegativeCacheHits;
+        //candidates not decoded because they were found in the cache of identified markers
+        int nIdentityCacheHits;
+        //blocks of the image that changed since the last frame processed (see setChangeGating)
+        int nDirtyTiles;
+        //regions found by the pre-screening (-1 if not done, see setPrescreen)
+        int nPrescreenRegions;
+        //number of candidates with a valid id
+        int nDecoded;
+        //markers detected twice
+        int nDuplicatesRemoved;
+        //contours rejected by each of the candidate filters (indexed by CandidateFilter)
+        int nRejected[NUM_CANDIDATE_FILTERS];
+    };
+    /**Returns the statistics of the last call to detect
+     */
+    const Stats & getStats()const{return _stats;}
 
     ///-------------------------------------------------
     /// Methods you may not need
@@ -264,6 +645,10 @@ public:
      * @param candidate candidate to refine corners
      */
     void refineCandidateLines(MarkerCandidate &candidate, const cv::Mat &camMatrix, const cv::Mat &distCoeff);    
+    /** Refine MarkerCandidate Corner using LINES method. The precomputed undistortion table of camParams is employed
+     * @param candidate candidate to refine corners
+     */
+    void refineCandidateLines(MarkerCandidate &candidate, const CameraParameters &camParams);
     
     
     /**DEPRECATED!!! Use the member function in CameraParameters
@@ -283,16 +668,67 @@ public:
 
 private:
 
-     bool warp_cylinder ( cv::Mat &in,cv::Mat &out,cv::Size size, MarkerCandidate& mc ) throw ( cv::Exception );
+    /**Common implementation of the public detect functions. camParams is NULL if the camera was given as matrices, and
+     * pyramid is NULL if the image was not given as a pyramid
+     */
+    void detect(const cv::Mat &input,std::vector<Marker> &detectedMarkers,const cv::Mat &camMatrix,const cv::Mat &distCoeff,float markerSizeMeters,bool setYPerperdicular,const CameraParameters *camParams,const ImagePyramid *pyramid=NULL) throw (cv::Exception);
+    /**Same as warp, but for markers on cylindrical surfaces. The contour of the candidate is employed.
+     */
+    bool warp_cylinder ( cv::Mat &in,cv::Mat &out,cv::Size size, MarkerCandidate& mc ) throw ( cv::Exception );
     /**
-    * Detection of candidates to be markers, i.e., rectangles.
-    * This function returns in candidates all the rectangles found in a thresolded image
+    * Same as the public detectRectangles, but the candidates keep the contour they were extracted from, as required by
+    * warp_cylinder and refineCandidateLines
+    * @param regions if not NULL, contours are only looked for in these rectangles of thresImg
+    */
+    void detectRectangles(const cv::Mat &thresImg,vector<MarkerCandidate> & candidates,const std::vector<cv::Rect> *regions=NULL);
+    /**
+    * Detection of candidates to be markers from the edges of an image (EDGE_SEGMENTS method). The edge pixels are grouped by the
+    * orientation of the gradient into straight segments, oriented so that the dark side is always at the same side. Collinear segments
+    * separated by a gap (e.g., a side crossed by an occluding object) are joined, and the segments whose lines meet near their ends
+    * are linked into quadrilaterals that are dark inside. The candidates returned have no contour.
+    * The joining and linking only compare the segments whose ends are near (found with a grid of their ends), so their cost grows
+    * with the number of segments times the number of neighbours of each one, instead of with the square of the number of segments.
+    * @param grey image whose edges are in edgesImg
+    * @param edgesImg edges of grey, as obtained by thresHold(EDGE_SEGMENTS,...)
+    * @param regions if not NULL, segments are only looked for in these rectangles of edgesImg
     */
-    void detectRectangles(const cv::Mat &thresImg,vector<MarkerCandidate> & candidates);
+    void detectSegmentQuads(const cv::Mat &grey,const cv::Mat &edgesImg,vector<MarkerCandidate> & candidates,const std::vector<cv::Rect> *regions=NULL);
+
+    /**Moves each corner to the point of maximum Harris response in a window of blockSize around it (HARRIS refinement)
+     */
+    void findBestCornerInRegion_harris(const cv::Mat  & grey,vector<cv::Point2f> &  Corners,int blockSize);
     //Current threshold method
     ThresholdMethods _thresMethod;
     //Threshold parameters
     double _thresParam1,_thresParam2;
+    //several threshold parameters employed in the same call, and the buffers employed with them
+    std::vector<std::pair<double,double> > _thresParamsList;
+    std::vector<cv::Mat> _multiThres;
+    cv::Mat _multiThresPadded,_multiThresSum;
+    //automatic tuning of the threshold parameters
+    bool _tuneEnabled;
+    int _tuneMinBlock,_tuneMaxBlock,_tunePeriod;
+    double _tuneMinConst,_tuneMaxConst;
+    //best parameters found and their score (valid if _tuneHasScore)
+    double _tuneBestParam1,_tuneBestParam2,_tuneBestScore;
+    bool _tuneHasScore;
+    //direction of the neighbour under evaluation (-1 if the best parameters are in use), next direction to try, and number of directions
+    //tried without improvement
+    int _tuneDirection,_tuneNextDirection,_tuneFailures;
+    //calls evaluated with the parameters in use and sum of their scores
+    int _tuneFrames;
+    double _tuneScoreSum;
+    //evaluation periods to wait before exploring again
+    int _tuneWait;
+    //speed governor: target time, levels, level in use and average time measured in each level (-1 if unknown)
+    double _govTarget;
+    std::vector<SpeedSettings> _govLadder;
+    int _govLevel;
+    std::vector<double> _govTime;
+    //consecutive calls over the target, and calls since the last change of level
+    int _govCallsOver,_govCallsSinceChange;
+    //settings in use: these of the user, or these of the level of the speed governor
+    SpeedSettings _activeSpeed;
     //Current corner method
     CornerRefinementMethod _cornerMethod;
     //minimum and maximum size of a contour lenght
@@ -301,16 +737,193 @@ private:
     int _speed;
     int _markerWarpSize;
     bool _doErosion;
+    ContourMode _contourMode;
     float _borderDistThres;//border around image limits in which corners are not allowed to be detected.
+    //candidate filters applied to the 4 vertex polygons, in order
+    std::vector<CandidateFilter> _candidateFilters;
+    //parameters of the candidate filters
+    float _minSideLength,_minArea,_maxArea,_maxAspectRatio;
     //vectr of candidates to be markers. This is a vector with a set of rectangles that have no valid id
     vector<std::vector<cv::Point2f> > _candidates;
     //level of image reduction
     int pyrdown_level;
+    //pyramid of the grey image, kept between calls
+    ImagePyramid _pyramid;
+    bool _coarseToFine;
+    //automatic selection of the pyramid level
+    bool _autoScale;
+    float _autoScaleMinPixelsPerBit;
+    int _autoScaleGridSize,_autoScaleMaxLevel;
+    //fraction of the smallest marker observed employed as expected size
+    float _autoScaleMargin;
+    //level employed in the last call
+    int _autoScaleLevel;
+    //length of the smallest side of the markers detected in the last call (-1 if none)
+    float _observedMinSide;
+    //number of calls to detect
+    int _frameCounter;
+    //cache of rejected candidates: key -> last frame in which it is valid
+    bool _negCacheEnabled;
+    int _negCacheTTL,_negCacheQuantStep,_negCacheReverify;
+    struct NegativeCacheEntry {
+        int expires;//last frame in which it is valid
+        int lastVerified;//frame of the last decoding
+    };
+    std::map<uint64,NegativeCacheEntry> _negCache;
+    uint64 _negCacheHits,_negCacheLookups;
+    //cache of the markers identified in the last call
+    struct IdentityCacheEntry {
+        std::vector<cv::Point2f> corners;//corners of the candidate, as found before refinement
+        int id,nRotations;
+        std::string dictionary;
+        int lastVerified;//frame of the last full decoding
+    };
+    bool _idCacheEnabled;
+    int _idCacheInterval,_idCacheGridSize;
+    float _idCacheTolerance;
+    std::vector<IdentityCacheEntry> _idCache;
+    uint64 _idCacheHits,_idCacheMisses;
+    //regions of interest, given as mask (_roiMask) or rectangles (_roiRects) of the input image
+    bool _roiEnabled;
+    cv::Mat _roiMask;
+    std::vector<cv::Rect> _roiRects;
+    //regions of interest at a level of the pyramid: rectangles to process, and the spans of each row inside the
+    //mask (empty if the regions are rectangles). Computed when first needed
+    struct RoiLevel {
+        cv::Size imSize;
+        std::vector<cv::Rect> rects;
+        std::vector<std::vector<cv::Vec2i> > rowSpans;
+    };
+    std::vector<RoiLevel> _roiLevels;
+    //change gating
+    enum FrameChange {FRAME_UNCHANGED,FRAME_PARTIAL,FRAME_CHANGED};
+    bool _gateEnabled;
+    int _gateBlockSize;
+    float _gateThreshold,_gateMaxPartialFraction;
+    //block means of the last frame processed, and those of the current one
+    cv::Mat _gateDigest,_gateCurrent;
+    //result of the last frame processed and the parameters employed
+    std::vector<Marker> _gateMarkers;
+    float _gateMarkerSize;
+    bool _gateSetY;
+    cv::Mat _gateCamMatrix;
+    //pyramid level of the last frame processed
+    int _gateLevel;
+    uint64 _gateFrames,_gateSkipped,_gatePartial;
     //Images
     cv::Mat grey,thres,thres2,reduced;
+    //regions of thres written since it was cleared (all of it if _thresWrittenAll)
+    std::vector<cv::Rect> _thresWritten;
+    bool _thresWrittenAll;
     //pointer to the function that analizes a rectangular region so as to detect its internal marker
     int (* markerIdDetector_ptrfunc)(const cv::Mat &in,int &nRotations);
-
+    //decoders tried in order on each candidate (if not empty), and the sample shared by them
+    std::vector<MarkerDecoder*> _decoders;
+    MarkerSample _sample;
+    //ids of the markers to detect (all if empty)
+    std::set<int> _allowedIds;
+    //statistics of the last detection
+    Stats _stats;
+    //time budget (ms) of detect, and data about its last use
+    double _timeBudget;
+    int _candidateBudget;
+    CandidatePriority _candidatePriority;
+    bool _partialDetection;
+    vector<std::vector<cv::Point2f> > _skippedCandidates;
+    //centers of the markers detected in the last call, employed by PRIORITY_TRACKED
+    vector<cv::Point2f> _prevMarkerCenters;
+    //pre-screening of the frames in a thumbnail
+    bool _prescreenEnabled;
+    int _prescreenLevel,_prescreenMargin,_prescreenInterval;
+    //calls since the whole image was processed last
+    int _prescreenCounter;
+    //regions found in the last call, and those of the markers detected then (in the input image)
+    std::vector<cv::Rect> _prescreenRegions,_prescreenMarkerRects;
+    cv::Mat _prescreenThres;
+
+    /**Applies the candidate filters to the 4 vertex polygon quad found in an image of size imSize.
+     * @return the filter that rejects it, or -1 if all of them are passed
+     */
+    int applyCandidateFilters(const std::vector<cv::Point> &quad,cv::Size imSize)const;
+    /**Key of a candidate for the candidate caches. It combines the quantized location of its corners and a hash of a few
+     * pixels inside it, starting from a corner chosen independently of the order of the corners in the candidate
+     * @param startCorner output index of the corner of the candidate employed as first one
+     */
+    uint64 candidateKey(const std::vector<cv::Point2f> &candidate,const cv::Mat &grey,int quantStep,int &startCorner)const;
+    /**Returns the regions of interest for the level indicated, computing them if not done yet
+     */
+    const RoiLevel & getRoiLevel(int level,cv::Size levelSize);
+    /**Compares the grey image with the last one processed. In case of FRAME_PARTIAL, returns in changedRegions the regions
+     * of the image to process
+     */
+    FrameChange checkFrameChange(const cv::Mat &grey,const cv::Mat &camMatrix,float markerSizeMeters,bool setYPerpendicular,std::vector<cv::Rect> &changedRegions);
+    /**Discards the result of the last frame processed, so that the next one is fully processed. Called when the parameters change
+     */
+    void resetChangeGate(){_gateDigest.release();_gateMarkers.clear();}
+    /**Finds the quadrilaterals of a thumbnail of the image, and returns their bounding rectangles (with a margin) in the image.
+     * @param thumb thumbnail
+     * @param scale size of the image divided by the size of the thumbnail
+     * @param imSize size of the image
+     */
+    void prescreen(const cv::Mat &thumb,float scale,cv::Size imSize,std::vector<cv::Rect> &regions);
+    /**Thresholds (and erodes if required) the image only in the regions of interest. The rest of thresImg is set to zero
+     * if clearOutside, or kept otherwise
+     */
+    void thresHoldROI(const RoiLevel &roi,const cv::Mat &grey,cv::Mat &thresImg,double param1,double param2,bool clearOutside=true);
+    /**Prepares thresImg (the image thres) before writing the regions indicated (the whole image if NULL): the regions written in the
+     * last call are set to zero, instead of the whole image
+     */
+    void resetThresholded(cv::Mat &thresImg,cv::Size size,const std::vector<cv::Rect> *regions);
+    /**Sets to zero the pixels of thresImg in rect that are out of the mask of roi
+     */
+    static void clearOutsideSpans(const RoiLevel &roi,const cv::Rect &rect,cv::Mat &thresImg);
+    /**Thresholds grey with each pair of parameters (in parallel), and returns in candidates the rectangles found in all the
+     * thresholded images, without repetitions
+     */
+    void detectRectanglesMulti(const cv::Mat &grey,const std::vector<std::pair<double,double> > &params,const RoiLevel *roi,vector<MarkerCandidate> &candidates);
+    /**Same as detectRectangles, but repeated rectangles are not removed
+     */
+    void findRectangles(const cv::Mat &thresImg,vector<MarkerCandidate> & candidates,const std::vector<cv::Rect> *regions);
+    /**Appends to out the candidates of in that are not too near to a bigger one
+     */
+    void removeRepeatedCandidates(vector<MarkerCandidate> &in,vector<MarkerCandidate> &out);
+    /**Updates the automatic tuning of the threshold parameters with the result of a call to detect
+     * @param nMarkers markers detected
+     * @param nFailed candidates not identified
+     */
+    void updateThresholdTuning(int nMarkers,int nFailed);
+    /**Sets as parameters in use the neighbour of the best ones in direction dir. Returns false if it is out of the limits
+     */
+    bool setThresholdTuningNeighbour(int dir);
+    /**Rebuilds the levels of the speed governor from the settings of the user, and updates the settings in use. Called when any of them changes
+     */
+    void updateSpeedSettings();
+    /**Updates the speed governor with the time in milliseconds of a call to detect
+     */
+    void updateSpeedGovernor(double ms);
+    /**Looks for the candidate in the cache of identified markers
+     * @return the index of the entry matched or -1. In nRotations, the rotations of the candidate
+     */
+    int findInIdentityCache(const std::vector<cv::Point2f> &candidate,int &nRotations)const;
+    /**Quick test of the black border of a marker of _idCacheGridSize bits: the cells of the border must be darker than the surroundings
+     */
+    bool checkMarkerBorder(const std::vector<cv::Point2f> &candidate,const cv::Mat &grey)const;
+    /**Number of pixels per bit (in the original image) of the smallest marker expected
+     */
+    float expectedPixelsPerBit(cv::Size imSize)const;
+    /**Level of the pyramid selected in auto scale mode
+     */
+    int selectAutoScaleLevel(cv::Size imSize)const;
+    /**Refines with cornerSubPix the corners (expressed in the original image) in img, which is reduced by scale.
+     * Markers are distributed among threads
+     */
+    void cornerSubPixParallel(const cv::Mat &img,vector<cv::Point2f> &Corners,float scale);
+    /**Sorts the candidates in descending order of priority according to _candidatePriority
+     */
+    void sortCandidatesByPriority(vector<MarkerCandidate> &candidates,const cv::Mat &grey);
+    /**Marks for removal the candidates whose corners are too near to these of another with a bigger perimeter
+     */
+    void removeTooNearCandidates(vector<MarkerCandidate> &candidates,vector<bool> &toRemove);
     /**
      */
     bool isInto(cv::Mat &contour,std::vector<cv::Point2f> &b);
@@ -328,14 +941,6 @@ private:
 //                         double b1, double b2, double b3 );
 // 
 
-    //detection of the
-    void findBestCornerInRegion_harris(const cv::Mat  & grey,vector<cv::Point2f> &  Corners,int blockSize);
-   
-    
-    // auxiliar functions to perform LINES refinement
-    void interpolate2Dline( const vector< cv::Point2f > &inPoints, cv::Point3f &outLine);
-    cv::Point2f getCrossPoint(const cv::Point3f& line1, const cv::Point3f& line2);      
-    void distortPoints(vector<cv::Point2f> in, vector<cv::Point2f> &out, const cv::Mat &camMatrix, const cv::Mat &distCoeff);    
     
     
     /**Given a vector vinout with elements and a boolean vector indicating the lements from it to remove, 
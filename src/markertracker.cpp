@@ -0,0 +1,244 @@
+/*****************************
+Copyright 2011 Rafael Muñoz Salinas. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY Rafael Muñoz Salinas ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Rafael Muñoz Salinas OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of Rafael Muñoz Salinas.
+********************************/
+#include "markertracker.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
+#include <algorithm>
+using namespace cv;
+using namespace std;
+namespace aruco
+{
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+MarkerTracker::MarkerTracker()
+{
+    _markerSize=-1;
+    _setYPerpendicular=false;
+    _redetectionInterval=10;
+    _framesSinceDetection=0;
+    _minTrackedFraction=0.75;
+    _winSize=21;
+    _maxLevel=3;
+    _gridSize=7;
+    _maxSignatureErrors=3;
+    _lastFrameDetected=false;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerTracker::setParams(const CameraParameters &cp,float markerSizeMeters)
+{
+    _camParams=cp;
+    _markerSize=markerSizeMeters;
+}
+
+void MarkerTracker::setRedetectionInterval(int nFrames)throw(cv::Exception)
+{
+    if (nFrames<1) throw cv::Exception(9001,"invalid number of frames","MarkerTracker::setRedetectionInterval",__FILE__,__LINE__);
+    _redetectionInterval=nFrames;
+}
+
+void MarkerTracker::setMinTrackedFraction(float val)throw(cv::Exception)
+{
+    if (val<=0 || val>1) throw cv::Exception(9001,"fraction out of range","MarkerTracker::setMinTrackedFraction",__FILE__,__LINE__);
+    _minTrackedFraction=val;
+}
+
+void MarkerTracker::setOpticalFlowParams(int winSize,int maxLevel)throw(cv::Exception)
+{
+    if (winSize<3 || maxLevel<0) throw cv::Exception(9001,"invalid optical flow parameters","MarkerTracker::setOpticalFlowParams",__FILE__,__LINE__);
+    _winSize=winSize;
+    _maxLevel=maxLevel;
+    //the pyramids must be rebuilt with the new border
+    reset();
+}
+
+void MarkerTracker::setSignatureParams(int gridSize,int maxErrors)throw(cv::Exception)
+{
+    if (gridSize<2 || maxErrors<0) throw cv::Exception(9001,"invalid signature parameters","MarkerTracker::setSignatureParams",__FILE__,__LINE__);
+    _gridSize=gridSize;
+    _maxSignatureErrors=maxErrors;
+    reset();
+}
+
+void MarkerTracker::reset()
+{
+    _tracked.clear();
+    _signatures.clear();
+    _prevPyramid=ImagePyramid();
+    _framesSinceDetection=0;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerTracker::track(const cv::Mat &input,std::vector<Marker> &markers)throw(cv::Exception)
+{
+    if ( input.type() ==CV_8UC3 )   cv::cvtColor ( input,_grey,CV_BGR2GRAY );
+    else     _grey=input;
+
+    //the previous pyramid becomes the one of the previous frame, and the memory of the older one is reused.
+    //Levels have a border so that they can be employed by the optical flow, and there are enough for the detector too
+    std::swap ( _pyramid,_prevPyramid );
+    _pyramid.build ( _grey,std::max ( _maxLevel,_mdetector.getMaxPyrDownLevel() ) +1,_winSize );
+
+    //the speed governor of the detector may ask for longer intervals
+    int interval=_redetectionInterval*_mdetector.getActiveSpeedSettings().trackingInterval;
+    bool detectNow= _tracked.size() ==0 || _prevPyramid.empty() || _framesSinceDetection+1>=interval;
+    if ( !detectNow && trackMarkers ( markers ) <_minTrackedFraction ) detectNow=true;
+    if ( detectNow ) detectMarkers ( markers );
+    else _framesSinceDetection++;
+    _lastFrameDetected=detectNow;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void MarkerTracker::detectMarkers(std::vector<Marker> &markers)
+{
+    _mdetector.detect ( _pyramid,markers,_camParams,_markerSize,_setYPerpendicular );
+    _framesSinceDetection=0;
+    //keep the markers whose signature can be obtained
+    _tracked.clear();
+    _signatures.clear();
+    vector<uchar> signature;
+    for ( size_t i=0;i<markers.size();i++ )
+    {
+        if ( getSignature ( _pyramid[0],markers[i],signature ) )
+        {
+            _tracked.push_back ( markers[i] );
+            _signatures.push_back ( signature );
+        }
+    }
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+float MarkerTracker::trackMarkers(std::vector<Marker> &markers)
+{
+    vector<Point2f> prevPoints,nextPoints;
+    prevPoints.reserve ( _tracked.size() *4 );
+    for ( size_t i=0;i<_tracked.size();i++ )
+        prevPoints.insert ( prevPoints.end(),_tracked[i].begin(),_tracked[i].end() );
+    vector<uchar> status;
+    vector<float> err;
+    int maxLevel=std::min ( _maxLevel,std::min ( _pyramid.size(),_prevPyramid.size() )-1 );
+    cv::calcOpticalFlowPyrLK ( _prevPyramid.getLevels(),_pyramid.getLevels(),prevPoints,nextPoints,status,err,
+                               Size ( _winSize,_winSize ),maxLevel,TermCriteria ( TermCriteria::COUNT+TermCriteria::EPS,30,0.01 ) );
+
+    const Mat &grey=_pyramid[0];
+    vector<Marker> tracked;
+    vector<vector<uchar> > signatures;
+    vector<uchar> signature;
+    for ( size_t i=0;i<_tracked.size();i++ )
+    {
+        //all corners must have been found
+        bool ok=true;
+        for ( int c=0;c<4 && ok;c++ ) ok=status[i*4+c]!=0;
+        if ( !ok ) continue;
+        Marker m=_tracked[i];
+        for ( int c=0;c<4;c++ ) m[c]=nextPoints[i*4+c];
+        //the quad must still be a valid one, and the cells must be these of the marker
+        if ( !isContourConvex ( Mat ( ( vector<Point2f> & ) m ) ) ) continue;
+        if ( !getSignature ( grey,m,signature ) ) continue;
+        int nErrors=0;
+        for ( size_t b=0;b<signature.size();b++ )
+            if ( signature[b]!=_signatures[i][b] ) nErrors++;
+        if ( nErrors>_maxSignatureErrors ) continue;
+        tracked.push_back ( m );
+        signatures.push_back ( _signatures[i] );
+    }
+    float fraction=float ( tracked.size() ) /float ( _tracked.size() );
+    _tracked.swap ( tracked );
+    _signatures.swap ( signatures );
+
+    //output
+    markers=_tracked;
+    if ( _camParams.isValid() && _markerSize>0 )
+        for ( size_t i=0;i<markers.size();i++ )
+            markers[i].calculateExtrinsics ( _markerSize,_camParams,_setYPerpendicular );
+    return fraction;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+bool MarkerTracker::getSignature(const cv::Mat &grey,const std::vector<cv::Point2f> &corners,std::vector<uchar> &signature)const
+{
+    //homography from the grid to the image
+    Point2f gridCorners[4]={Point2f ( 0,0 ),Point2f ( _gridSize,0 ),Point2f ( _gridSize,_gridSize ),Point2f ( 0,_gridSize ) };
+    Point2f imCorners[4]={corners[0],corners[1],corners[2],corners[3]};
+    Mat H=getPerspectiveTransform ( gridCorners,imCorners );
+    vector<Point2f> cellCenters,imCenters;
+    cellCenters.reserve ( _gridSize*_gridSize );
+    for ( int y=0;y<_gridSize;y++ )
+        for ( int x=0;x<_gridSize;x++ )
+            cellCenters.push_back ( Point2f ( x+0.5f,y+0.5f ) );
+    perspectiveTransform ( cellCenters,imCenters,H );
+    //sample the centers
+    vector<int> values ( imCenters.size() );
+    int minV=255,maxV=0;
+    for ( size_t i=0;i<imCenters.size();i++ )
+    {
+        int x=cvRound ( imCenters[i].x ),y=cvRound ( imCenters[i].y );
+        if ( x<0 || y<0 || x>=grey.cols || y>=grey.rows ) return false;
+        values[i]=grey.at<uchar> ( y,x );
+        minV=std::min ( minV,values[i] );
+        maxV=std::max ( maxV,values[i] );
+    }
+    //not enough contrast to tell black from white cells
+    if ( maxV-minV<20 ) return false;
+    int thres= ( minV+maxV ) /2;
+    signature.resize ( values.size() );
+    for ( size_t i=0;i<values.size();i++ ) signature[i]= values[i]>thres ?1:0;
+    return true;
+}
+
+};
@@ -0,0 +1,133 @@
+/*****************************
+Copyright 2011 Rafael Muñoz Salinas. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY Rafael Muñoz Salinas ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Rafael Muñoz Salinas OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of Rafael Muñoz Salinas.
+********************************/
+#ifndef _Aruco_MarkerTracker_H
+#define _Aruco_MarkerTracker_H
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include "exports.h"
+#include "cameraparameters.h"
+#include "marker.h"
+#include "markerdetector.h"
+#include "imagepyramid.h"
+namespace aruco
+{
+
+/**\brief Detects markers in a video sequence, tracking them between full detections
+ *
+ * A full detection (MarkerDetector::detect) is done every few frames. In the frames in between, the corners of the
+ * markers are tracked from the previous frame with pyramidal Lucas-Kanade optical flow, and the identity of each marker
+ * is checked by sampling the cells of its grid and comparing them with the ones observed when it was detected.
+ * A full detection is done as soon as the fraction of markers tracked falls below a limit.
+ * The same image pyramid is employed for the optical flow and by the marker detector (see MarkerDetector::pyrDown).
+ * \code
+  MarkerTracker MT;
+  MT.setParams(CP,0.05);
+  while(capture_image(im)){
+    MT.track(im,markers);
+    ...
+  }
+ \endcode
+ */
+class ARUCO_EXPORTS MarkerTracker
+{
+public:
+    /**
+     */
+    MarkerTracker();
+    /**Sets the camera parameters and the size of the markers, employed to compute the extrinsics of the markers
+     */
+    void setParams(const CameraParameters &cp,float markerSizeMeters=-1);
+    /**Returns a reference to the internal marker detector, so that it can be configured
+     */
+    MarkerDetector &getMarkerDetector(){return _mdetector;}
+    /**Detects or tracks the markers in the next image of the sequence
+     * @param input input color image
+     * @param markers output vector with the markers
+     */
+    void track(const cv::Mat &input,std::vector<Marker> &markers)throw(cv::Exception);
+    /**Indicates if the markers of the last call to track were obtained with a full detection
+     */
+    bool wasLastFrameDetected()const{return _lastFrameDetected;}
+    /**Forgets the markers tracked, so that the next call to track does a full detection
+     */
+    void reset();
+
+    /**Sets the number of frames between full detections. 1 means detecting in all frames. Default value is 10.
+     * If the speed governor of the detector is enabled (see MarkerDetector::setTargetFrameTime), it is multiplied by the tracking interval of its settings
+     */
+    void setRedetectionInterval(int nFrames)throw(cv::Exception);
+    /**
+     */
+    int getRedetectionInterval()const{return _redetectionInterval;}
+    /**Sets the minimum fraction of markers (0,1] that must be tracked succesfully. Otherwise, a full detection is done. Default value is 0.75
+     */
+    void setMinTrackedFraction(float val)throw(cv::Exception);
+    /**
+     */
+    float getMinTrackedFraction()const{return _minTrackedFraction;}
+    /**Sets the parameters of the optical flow: size of the search window (in pixels) and number of pyramid levels employed
+     * above the base image. Default values are 21 and 3
+     */
+    void setOpticalFlowParams(int winSize,int maxLevel)throw(cv::Exception);
+    /**Sets the number of cells in each direction of the grid sampled to check the identity of a tracked marker (including
+     * the black border), and the maximum number of cells that can differ. Default values are 7 (aruco markers) and 3
+     */
+    void setSignatureParams(int gridSize,int maxErrors)throw(cv::Exception);
+    /**
+     */
+    void setYPerpendicular(bool enable){_setYPerpendicular=enable;}
+    /**Returns the pyramid of the last image passed to track
+     */
+    const ImagePyramid & getPyramid()const{return _pyramid;}
+
+private:
+    //does a full detection in the current pyramid
+    void detectMarkers(std::vector<Marker> &markers);
+    //tracks the markers of the previous frame. Returns the fraction of them succesfully tracked
+    float trackMarkers(std::vector<Marker> &markers);
+    //samples the cells of the grid of the marker and binarizes them. Returns false if not possible
+    bool getSignature(const cv::Mat &grey,const std::vector<cv::Point2f> &corners,std::vector<uchar> &signature)const;
+
+    MarkerDetector _mdetector;
+    CameraParameters _camParams;
+    float _markerSize;
+    bool _setYPerpendicular;
+    int _redetectionInterval,_framesSinceDetection;
+    float _minTrackedFraction;
+    int _winSize,_maxLevel;
+    int _gridSize,_maxSignatureErrors;
+    bool _lastFrameDetected;
+    //pyramids of the current and previous frames. Their memory is swapped between calls
+    ImagePyramid _pyramid,_prevPyramid;
+    cv::Mat _grey;
+    //markers being tracked and their signatures
+    std::vector<Marker> _tracked;
+    std::vector<std::vector<uchar> > _signatures;
+};
+};
+#endif
@@ -21,14 +21,19 @@ public:
 
     void checkTerm();
 
-    double pointDist(cv::Point2f estimate_corner,cv::Point2f curr_corner);
+    double pointDist(cv::Point2f estimate_corner,cv::Point2f curr_corner)const;
 
-    ///method to refine the corners
+    ///method to refine the corners. They are refined in parallel, each one as in the sequential version: the patch
+    ///around the current estimate and its gradients are obtained again in every iteration, so the results are the same
     void RefineCorner(cv::Mat image,std::vector <cv::Point2f> &corners);
 
     //function to generate the mask
     void generateMask();
 
+private:
+    //refines a single corner. It only reads the members, so it can be called in parallel
+    cv::Point2f refineCorner(const cv::Mat &image,cv::Point2f corner)const;
+
 
 };
 
@@ -0,0 +1,314 @@
+/*****************************
+Copyright 2011 Rafael Muñoz Salinas. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY Rafael Muñoz Salinas ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Rafael Muñoz Salinas OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of Rafael Muñoz Salinas.
+********************************/
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include "aruco.h"
+#include "syntheticscene.h"
+using namespace cv;
+using namespace aruco;
+using namespace std;
+
+/**Accumulated results of a detector configuration over all the frames of a size
+ */
+struct BenchResult
+{
+    BenchResult():nFrames(0),totalMs(0),nGroundTruth(0),nTruePositives(0),nFalsePositives(0),sqCornerError(0),nCorners(0){}
+    int nFrames;
+    double totalMs;
+    MarkerDetector::Stats stageMs;//sum of the stats of all frames
+    int nGroundTruth,nTruePositives,nFalsePositives;
+    double sqCornerError;
+    int nCorners;
+};
+
+//a detected marker is considered a true positive if its mean corner error is below this value (pixels)
+const double MaxCornerDistance=5;
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+int findParam ( std::string param,int argc, char *argv[] )
+{
+    for ( int i=0; i<argc; i++ )
+        if ( string ( argv[i] ) ==param ) return i;
+
+    return -1;
+
+}
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+const char * thresMethodName(MarkerDetector::ThresholdMethods m)
+{
+    switch(m){
+    case MarkerDetector::FIXED_THRES:return "FIXED_THRES";
+    case MarkerDetector::ADPT_THRES:return "ADPT_THRES";
+    case MarkerDetector::CANNY:return "CANNY";
+    case MarkerDetector::EDGE_SEGMENTS:return "EDGE_SEGMENTS";
+    };
+    return "UNKNOWN";
+}
+const char * cornerMethodName(MarkerDetector::CornerRefinementMethod m)
+{
+    switch(m){
+    case MarkerDetector::NONE:return "NONE";
+    case MarkerDetector::HARRIS:return "HARRIS";
+    case MarkerDetector::SUBPIX:return "SUBPIX";
+    case MarkerDetector::LINES:return "LINES";
+    };
+    return "UNKNOWN";
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+/**Sum of squared distances between the corners of the detected marker and the ground truth.
+ * The cyclic shift of the corners that minimizes the error is used, since markers with symmetric codes can be
+ * detected in several orientations.
+ */
+double sqCornerDistance(const Marker &detected,const vector<Point2f> &gt)
+{
+    double best=-1;
+    for (int s=0;s<4;s++) {
+        double err=0;
+        for (int c=0;c<4;c++) {
+            Point2f d=detected[(c+s)%4]-gt[c];
+            err+=d.x*d.x+d.y*d.y;
+        }
+        if (best<0 || err<best) best=err;
+    }
+    return best;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void addStats(MarkerDetector::Stats &acc,const MarkerDetector::Stats &s)
+{
+    acc.tGrey+=s.tGrey;
+    acc.tPyramid+=s.tPyramid;
+    acc.tPrescreen+=s.tPrescreen;
+    acc.tThreshold+=s.tThreshold;
+    acc.tErosion+=s.tErosion;
+    acc.tContours+=s.tContours;
+    acc.tQuadFilter+=s.tQuadFilter;
+    acc.tDuplicates+=s.tDuplicates;
+    acc.tWarpDecode+=s.tWarpDecode;
+    acc.tRefinement+=s.tRefinement;
+    acc.tPose+=s.tPose;
+    acc.tTotal+=s.tTotal;
+    acc.nContours+=s.nContours;
+    acc.nCandidates+=s.nCandidates;
+    acc.nDecodeAttempts+=s.nDecodeAttempts;
+    acc.nDecoded+=s.nDecoded;
+    acc.nNegativeCacheHits+=s.nNegativeCacheHits;
+    acc.nIdentityCacheHits+=s.nIdentityCacheHits;
+    acc.nDirtyTiles+=s.nDirtyTiles;
+    //-1 if the pre-screening was not done
+    if (s.nPrescreenRegions>=0) acc.nPrescreenRegions=std::max(acc.nPrescreenRegions,0)+s.nPrescreenRegions;
+    acc.nDuplicatesRemoved+=s.nDuplicatesRemoved;
+    for (int i=0;i<MarkerDetector::NUM_CANDIDATE_FILTERS;i++) acc.nRejected[i]+=s.nRejected[i];
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+BenchResult runConfiguration(MarkerDetector &MDetector,const vector<SyntheticScene> &scenes)
+{
+    BenchResult res;
+    vector<Marker> markers;
+    //warm up
+    MDetector.detect(scenes[0].image,markers);
+    for (size_t f=0;f<scenes.size();f++) {
+        double tick=(double)getTickCount();
+        MDetector.detect(scenes[f].image,markers);
+        res.totalMs+=1000.*((double)getTickCount()-tick)/getTickFrequency();
+        addStats(res.stageMs,MDetector.getStats());
+        res.nFrames++;
+
+        //match against the ground truth. Ids in a scene are unique
+        const vector<SyntheticMarker> &gt=scenes[f].markers;
+        res.nGroundTruth+=gt.size();
+        for (size_t i=0;i<markers.size();i++) {
+            bool matched=false;
+            for (size_t j=0;j<gt.size() && !matched;j++) {
+                if (gt[j].id!=markers[i].id) continue;
+                double sqErr=sqCornerDistance(markers[i],gt[j].corners);
+                if (sqrt(sqErr/4)<MaxCornerDistance) {
+                    matched=true;
+                    res.sqCornerError+=sqErr;
+                    res.nCorners+=4;
+                }
+            }
+            if (matched) res.nTruePositives++;
+            else res.nFalsePositives++;
+        }
+    }
+    return res;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+int main(int argc,char **argv)
+{
+    try
+    {
+        if (argc<2) {
+            cerr<<"Usage: out.yml [-frames n] [-markers n] [-seed s] [-bg backgrounds.txt]"<<endl;
+            cerr<<"\tbackgrounds.txt: file with the path of a background image per line"<<endl;
+            return -1;
+        }
+        int nFrames=20,nMarkers=6;
+        unsigned int seed=1234;
+        string bgList;
+        int idx;
+        if ((idx=findParam("-frames",argc,argv))!=-1) nFrames=std::max(1,atoi(argv[idx+1]));
+        if ((idx=findParam("-markers",argc,argv))!=-1) nMarkers=std::max(1,atoi(argv[idx+1]));
+        if ((idx=findParam("-seed",argc,argv))!=-1) seed=atoi(argv[idx+1]);
+        if ((idx=findParam("-bg",argc,argv))!=-1) bgList=argv[idx+1];
+
+        vector<string> bgPaths;
+        if (!bgList.empty()) {
+            ifstream file(bgList.c_str());
+            if (!file) {
+                cerr<<"Could not open "<<bgList<<endl;
+                return -1;
+            }
+            string line;
+            while (getline(file,line))
+                if (!line.empty()) bgPaths.push_back(line);
+        }
+
+        FileStorage fs(argv[1],FileStorage::WRITE);
+        if (!fs.isOpened()) {
+            cerr<<"Could not open "<<argv[1]<<endl;
+            return -1;
+        }
+        fs<<"frames"<<nFrames;
+        fs<<"markersPerFrame"<<nMarkers;
+        fs<<"seed"<<int(seed);
+        fs<<"backgrounds"<<int(bgPaths.size());
+        fs<<"results"<<"[";
+
+        Size sizes[4]={Size(320,240),Size(640,480),Size(1280,720),Size(1920,1080)};
+        MarkerDetector::ThresholdMethods thresMethods[4]={MarkerDetector::FIXED_THRES,MarkerDetector::ADPT_THRES,MarkerDetector::CANNY,MarkerDetector::EDGE_SEGMENTS};
+        MarkerDetector::CornerRefinementMethod cornerMethods[4]={MarkerDetector::NONE,MarkerDetector::HARRIS,MarkerDetector::SUBPIX,MarkerDetector::LINES};
+
+        printf("%-10s %-12s %-5s %-7s %8s %8s %7s %7s %8s\n","size","threshold","speed","corner","fps","ms","recall","FP/fr","rmse");
+        for (int s=0;s<4;s++) {
+            //all the configurations are evaluated on the same scenes
+            SyntheticSceneGenerator::Params params;
+            params.imageSize=sizes[s];
+            params.nMarkers=nMarkers;
+            SyntheticSceneGenerator generator(params,seed);
+            if (!bgPaths.empty() && generator.loadBackgrounds(bgPaths)==0)
+                cerr<<"None of the background images could be read. Using procedural backgrounds"<<endl;
+            vector<SyntheticScene> scenes(nFrames);
+            for (int f=0;f<nFrames;f++) scenes[f]=generator.generate();
+
+            for (int t=0;t<4;t++)
+                for (int speed=0;speed<=3;speed++)
+                    for (int c=0;c<4;c++) {
+                        //a new detector each time, since setDesiredSpeed does not restore all the parameters it changes
+                        MarkerDetector MDetector;
+                        MDetector.setThresholdMethod(thresMethods[t]);
+                        if (thresMethods[t]==MarkerDetector::FIXED_THRES) MDetector.setThresholdParams(100,0);
+                        MDetector.setDesiredSpeed(speed);
+                        MDetector.setCornerRefinementMethod(cornerMethods[c]);
+
+                        BenchResult res=runConfiguration(MDetector,scenes);
+                        double msPerFrame=res.totalMs/res.nFrames;
+                        double recall=res.nGroundTruth>0?double(res.nTruePositives)/res.nGroundTruth:0;
+                        double fpPerFrame=double(res.nFalsePositives)/res.nFrames;
+                        double rmse=res.nCorners>0?sqrt(res.sqCornerError/res.nCorners):-1;
+                        const MarkerDetector::Stats &st=res.stageMs;
+                        double n=res.nFrames;
+
+                        fs<<"{";
+                        fs<<"width"<<sizes[s].width<<"height"<<sizes[s].height;
+                        fs<<"thresholdMethod"<<thresMethodName(thresMethods[t]);
+                        fs<<"speed"<<speed;
+                        fs<<"cornerMethod"<<cornerMethodName(cornerMethods[c]);
+                        fs<<"fps"<<1000./msPerFrame;
+                        fs<<"msPerFrame"<<msPerFrame;
+                        fs<<"recall"<<recall;
+                        fs<<"falsePositives"<<res.nFalsePositives;
+                        fs<<"falsePositivesPerFrame"<<fpPerFrame;
+                        fs<<"cornerRMSE"<<rmse;
+                        //mean time of each stage. Zero if the library is compiled without ARUCO_DETECTION_STATS
+                        fs<<"stagesMs"<<"{";
+                        fs<<"grey"<<st.tGrey/n<<"pyramid"<<st.tPyramid/n<<"prescreen"<<st.tPrescreen/n<<"threshold"<<st.tThreshold/n<<"erosion"<<st.tErosion/n;
+                        fs<<"contours"<<st.tContours/n<<"quadFilter"<<st.tQuadFilter/n<<"duplicates"<<st.tDuplicates/n;
+                        fs<<"warpDecode"<<st.tWarpDecode/n<<"refinement"<<st.tRefinement/n<<"pose"<<st.tPose/n<<"total"<<st.tTotal/n;
+                        fs<<"}";
+                        fs<<"countersPerFrame"<<"{";
+                        fs<<"contours"<<st.nContours/n<<"candidates"<<st.nCandidates/n<<"decodeAttempts"<<st.nDecodeAttempts/n<<"negativeCacheHits"<<st.nNegativeCacheHits/n<<"identityCacheHits"<<st.nIdentityCacheHits/n<<"dirtyTiles"<<st.nDirtyTiles/n<<"prescreenRegions"<<st.nPrescreenRegions/n;
+                        fs<<"decoded"<<st.nDecoded/n<<"duplicatesRemoved"<<st.nDuplicatesRemoved/n;
+                        fs<<"rejected"<<"{";
+                        for (int f=0;f<MarkerDetector::NUM_CANDIDATE_FILTERS;f++)
+                            fs<<MarkerDetector::getCandidateFilterName(MarkerDetector::CandidateFilter(f))<<st.nRejected[f]/n;
+                        fs<<"}";
+                        fs<<"}";
+                        fs<<"}";
+
+                        stringstream sstr;
+                        sstr<<sizes[s].width<<"x"<<sizes[s].height;
+                        printf("%-10s %-12s %-5d %-7s %8.1f %8.2f %7.3f %7.2f %8.3f\n",sstr.str().c_str(),thresMethodName(thresMethods[t]),speed,
+                               cornerMethodName(cornerMethods[c]),1000./msPerFrame,msPerFrame,recall,fpPerFrame,rmse);
+                    }
+        }
+        fs<<"]";
+        fs.release();
+    } catch (std::exception &ex)
+    {
+        cout<<"Exception :"<<ex.what()<<endl;
+    }
+}
@@ -0,0 +1,419 @@
+/*****************************
+Copyright 2011 Rafael Muñoz Salinas. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY Rafael Muñoz Salinas ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Rafael Muñoz Salinas OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of Rafael Muñoz Salinas.
+********************************/
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include "aruco.h"
+#include "arucofidmarkers.h"
+#include "hammingcode.h"
+#include "highlyreliablemarkers.h"
+#include "subpixelcorner.h"
+#include "syntheticscene.h"
+using namespace cv;
+using namespace aruco;
+using namespace std;
+
+namespace aruco
+{
+/**Access to the internal kernels of MarkerDetector, of which it is a friend, so that they are measured in isolation
+ */
+class MarkerDetectorBenchAccess
+{
+public:
+    typedef MarkerDetector::MarkerCandidate Candidate;
+    static void detectRectangles(MarkerDetector &md,const Mat &thres,vector<Candidate> &candidates){md.detectRectangles(thres,candidates);}
+    static void detectSegmentQuads(MarkerDetector &md,const Mat &grey,const Mat &edges,vector<Candidate> &candidates){md.detectSegmentQuads(grey,edges,candidates);}
+    static bool warp_cylinder(MarkerDetector &md,Mat &in,Mat &out,Size size,Candidate &mc){return md.warp_cylinder(in,out,size,mc);}
+    static void findBestCornerInRegion_harris(MarkerDetector &md,const Mat &grey,vector<Point2f> &corners,int blockSize){md.findBestCornerInRegion_harris(grey,corners,blockSize);}
+    static void refineCandidateLines(MarkerDetector &md,Candidate &candidate,const Mat &camMatrix,const Mat &distCoeff){md.refineCandidateLines(candidate,camMatrix,distCoeff);}
+};
+}
+typedef MarkerDetectorBenchAccess::Candidate Candidate;
+
+/**Fixed inputs shared by all the kernels. They are created once from a seeded synthetic scene
+ */
+struct BenchInput
+{
+    Mat image,grey,thres,edges;
+    Mat camMatrix,distCoeff;
+    vector<vector<Point2f> > candidates;
+    vector<Candidate> mcandidates;
+    vector<Point2f> corners;//corners of all the candidates
+    vector<Marker> markers;//markers detected in the image
+    vector<Mat> hammingBits;//5x5 codes
+    vector<Mat> hrmImages;//canonical images of the hrm dictionary
+    BoardConfiguration boardConfig;
+    vector<Marker> boardMarkers;//markers detected in the board image
+};
+
+/**A kernel to be measured. run() must do the same work every time it is called
+ */
+struct Kernel
+{
+    Kernel(const string &n):name(n){}
+    virtual ~Kernel(){}
+    virtual void run()=0;
+    string name;
+};
+
+/************************************
+ *
+ * The kernels
+ *
+ *
+ ************************************/
+struct ThresholdKernel:public Kernel
+{
+    ThresholdKernel(const string &n,BenchInput &in,MarkerDetector::ThresholdMethods m,double p1=-1,double p2=-1):Kernel(n),_in(in),_method(m),_p1(p1),_p2(p2){}
+    void run(){_md.thresHold(_method,_in.grey,_out,_p1,_p2);}
+    BenchInput &_in;MarkerDetector _md;MarkerDetector::ThresholdMethods _method;double _p1,_p2;Mat _out;
+};
+struct DetectRectanglesKernel:public Kernel
+{
+    DetectRectanglesKernel(BenchInput &in):Kernel("detectRectangles"),_in(in){}
+    void run(){_md.detectRectangles(_in.thres,_out);}
+    BenchInput &_in;MarkerDetector _md;vector<vector<Point2f> > _out;
+};
+struct DetectSegmentQuadsKernel:public Kernel
+{
+    DetectSegmentQuadsKernel(BenchInput &in):Kernel("detectSegmentQuads"),_in(in){}
+    void run(){_out.clear();MarkerDetectorBenchAccess::detectSegmentQuads(_md,_in.grey,_in.edges,_out);}
+    BenchInput &_in;MarkerDetector _md;vector<Candidate> _out;
+};
+struct WarpKernel:public Kernel
+{
+    WarpKernel(BenchInput &in):Kernel("warp"),_in(in){}
+    void run(){
+        for (size_t i=0;i<_in.candidates.size();i++)
+            _md.warp(_in.grey,_out,Size(56,56),_in.candidates[i]);
+    }
+    BenchInput &_in;MarkerDetector _md;Mat _out;
+};
+struct WarpCylinderKernel:public Kernel
+{
+    WarpCylinderKernel(BenchInput &in):Kernel("warp_cylinder"),_in(in){}
+    void run(){
+        for (size_t i=0;i<_in.mcandidates.size();i++)
+            MarkerDetectorBenchAccess::warp_cylinder(_md,_in.grey,_out,Size(56,56),_in.mcandidates[i]);
+    }
+    BenchInput &_in;MarkerDetector _md;Mat _out;
+};
+struct HammingDecodeKernel:public Kernel
+{
+    HammingDecodeKernel(BenchInput &in):Kernel("HammingCode::decode"),_in(in),_sum(0){}
+    void run(){
+        for (size_t i=0;i<_in.hammingBits.size();i++)
+            _sum+=nkdhny::HammingCode::decode(_in.hammingBits[i]);
+    }
+    BenchInput &_in;int _sum;
+};
+struct HRMDetectKernel:public Kernel
+{
+    HRMDetectKernel(BenchInput &in):Kernel("HighlyReliableMarkers::detect"),_in(in),_sum(0){}
+    void run(){
+        int nRotations;
+        for (size_t i=0;i<_in.hrmImages.size();i++)
+            _sum+=HighlyReliableMarkers::detect(_in.hrmImages[i],nRotations);
+    }
+    BenchInput &_in;int _sum;
+};
+struct CornerSubPixKernel:public Kernel
+{
+    CornerSubPixKernel(BenchInput &in):Kernel("cornerSubPix"),_in(in){}
+    void run(){
+        //same parameters than MarkerDetector::detect
+        _corners=_in.corners;
+        cornerSubPix(_in.grey,_corners,cvSize(5,5),cvSize(-1,-1),cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,3,0.05));
+    }
+    BenchInput &_in;vector<Point2f> _corners;
+};
+struct HarrisKernel:public Kernel
+{
+    HarrisKernel(BenchInput &in):Kernel("findBestCornerInRegion_harris"),_in(in){}
+    void run(){
+        _corners=_in.corners;
+        MarkerDetectorBenchAccess::findBestCornerInRegion_harris(_md,_in.grey,_corners,7);
+    }
+    BenchInput &_in;MarkerDetector _md;vector<Point2f> _corners;
+};
+struct LinesKernel:public Kernel
+{
+    LinesKernel(BenchInput &in):Kernel("refineCandidateLines"),_in(in){}
+    void run(){
+        for (size_t i=0;i<_in.mcandidates.size();i++){
+            _cand=_in.mcandidates[i];
+            MarkerDetectorBenchAccess::refineCandidateLines(_md,_cand,_in.camMatrix,_in.distCoeff);
+        }
+    }
+    BenchInput &_in;MarkerDetector _md;Candidate _cand;
+};
+struct SubPixelCornerKernel:public Kernel
+{
+    SubPixelCornerKernel(BenchInput &in):Kernel("SubPixelCorner::RefineCorner"),_in(in){}
+    void run(){
+        _corners=_in.corners;
+        _spc.RefineCorner(_in.grey,_corners);
+    }
+    BenchInput &_in;SubPixelCorner _spc;vector<Point2f> _corners;
+};
+struct ExtrinsicsKernel:public Kernel
+{
+    ExtrinsicsKernel(BenchInput &in):Kernel("Marker::calculateExtrinsics"),_in(in){}
+    void run(){
+        for (size_t i=0;i<_in.markers.size();i++){
+            _marker=_in.markers[i];
+            _marker.calculateExtrinsics(0.05,_in.camMatrix,_in.distCoeff);
+        }
+    }
+    BenchInput &_in;Marker _marker;
+};
+struct BoardDetectorKernel:public Kernel
+{
+    BoardDetectorKernel(BenchInput &in):Kernel("BoardDetector::detect"),_in(in){}
+    void run(){
+        _bd.detect(_in.boardMarkers,_in.boardConfig,_board,_in.camMatrix,_in.distCoeff,0.03);
+    }
+    BenchInput &_in;BoardDetector _bd;Board _board;
+};
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+/**Creates the image of a board with ids 0...n-1 (createBoardImage selects them randomly), and its configuration
+ */
+Mat createBoard(Size gridSize,int markerSize,int markerDistance,BoardConfiguration &bc)
+{
+    int sizeY=gridSize.height*markerSize+(gridSize.height-1)*markerDistance;
+    int sizeX=gridSize.width*markerSize+(gridSize.width-1)*markerDistance;
+    Mat board(sizeY,sizeX,CV_8UC1,Scalar(255));
+    bc.mInfoType=BoardConfiguration::PIX;
+    bc.clear();
+    int id=0;
+    for (int y=0;y<gridSize.height;y++)
+        for (int x=0;x<gridSize.width;x++,id++) {
+            int px=x*(markerDistance+markerSize),py=y*(markerDistance+markerSize);
+            Mat subrect=board(Rect(px,py,markerSize,markerSize));
+            FiducidalMarkers<nkdhny::HammingCode>::createMarkerImage(id,markerSize,false).copyTo(subrect);
+            bc.push_back(MarkerInfo(id));
+            bc.back().push_back(Point3f(px-sizeX/2,py-sizeY/2,0));
+            bc.back().push_back(Point3f(px+markerSize-sizeX/2,py-sizeY/2,0));
+            bc.back().push_back(Point3f(px+markerSize-sizeX/2,py+markerSize-sizeY/2,0));
+            bc.back().push_back(Point3f(px-sizeX/2,py+markerSize-sizeY/2,0));
+        }
+    return board;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void createInput(BenchInput &in,Size size,unsigned int seed)
+{
+    SyntheticSceneGenerator::Params params;
+    params.imageSize=size;
+    params.nMarkers=9;
+    SyntheticSceneGenerator generator(params,seed);
+    in.image=generator.generate().image;
+    cvtColor(in.image,in.grey,CV_BGR2GRAY);
+
+    //a camera with some radial distortion, so that the undistortion paths are exercised
+    in.camMatrix=Mat::eye(3,3,CV_32F);
+    in.camMatrix.at<float>(0,0)=in.camMatrix.at<float>(1,1)=size.width;
+    in.camMatrix.at<float>(0,2)=size.width/2.;
+    in.camMatrix.at<float>(1,2)=size.height/2.;
+    in.distCoeff=Mat::zeros(4,1,CV_32F);
+    in.distCoeff.at<float>(0,0)=-0.1;
+    in.distCoeff.at<float>(1,0)=0.01;
+
+    MarkerDetector MD;
+    MD.thresHold(MarkerDetector::ADPT_THRES,in.grey,in.thres);
+    MD.detectRectangles(in.thres,in.candidates);
+    MarkerDetectorBenchAccess::detectRectangles(MD,in.thres,in.mcandidates);
+    MD.thresHold(MarkerDetector::EDGE_SEGMENTS,in.grey,in.edges);
+    for (size_t i=0;i<in.candidates.size();i++)
+        for (int c=0;c<4;c++) in.corners.push_back(in.candidates[i][c]);
+    MD.detect(in.image,in.markers,in.camMatrix,in.distCoeff);
+
+    //canonical codes
+    RNG rng(seed);
+    for (int i=0;i<64;i++) {
+        in.hammingBits.push_back(Mat());
+        nkdhny::HammingCode::encode(rng.uniform(0,1024),in.hammingBits.back());
+    }
+    Dictionary D;
+    for (int i=0;i<64;i++) {
+        MarkerCode code(5);
+        for (unsigned int b=0;b<code.size();b++) code.set(b,rng.uniform(0,2)==1);
+        D.push_back(code);
+    }
+    HighlyReliableMarkers::loadDictionary(D);
+    for (size_t i=0;i<D.size();i++)
+        in.hrmImages.push_back(D[i].getImg(63));
+
+    //a board seen with some perspective
+    Mat board=createBoard(Size(5,4),60,15,in.boardConfig);
+    Point2f src[4]={Point2f(0,0),Point2f(board.cols,0),Point2f(board.cols,board.rows),Point2f(0,board.rows)};
+    Point2f dst[4]={Point2f(0.15*size.width,0.1*size.height),Point2f(0.85*size.width,0.15*size.height),
+                    Point2f(0.8*size.width,0.9*size.height),Point2f(0.1*size.width,0.85*size.height)};
+    Mat boardImage;
+    warpPerspective(board,boardImage,getPerspectiveTransform(src,dst),size,INTER_LINEAR,BORDER_CONSTANT,Scalar(128));
+    MD.detect(boardImage,in.boardMarkers);
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+struct KernelTimes
+{
+    double median,p99,mean,min;
+};
+KernelTimes measure(Kernel &k,int nWarmup,int nReps)
+{
+    for (int i=0;i<nWarmup;i++) k.run();
+    vector<double> times(nReps);
+    for (int i=0;i<nReps;i++) {
+        int64 tick=getTickCount();
+        k.run();
+        times[i]=1000.*double(getTickCount()-tick)/getTickFrequency();
+    }
+    sort(times.begin(),times.end());
+    KernelTimes kt;
+    kt.median=times[nReps/2];
+    kt.p99=times[std::min(nReps-1,int(ceil(0.99*nReps))-1)];
+    kt.min=times[0];
+    kt.mean=0;
+    for (int i=0;i<nReps;i++) kt.mean+=times[i];
+    kt.mean/=nReps;
+    return kt;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+int findParam ( std::string param,int argc, char *argv[] )
+{
+    for ( int i=0; i<argc; i++ )
+        if ( string ( argv[i] ) ==param ) return i;
+
+    return -1;
+
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+int main(int argc,char **argv)
+{
+    try
+    {
+        if (findParam("-h",argc,argv)!=-1) {
+            cerr<<"Usage: [-o out.yml] [-reps n] [-warmup n] [-size WxH] [-seed s] [-k kernel_name]"<<endl;
+            return 0;
+        }
+        int nReps=200,nWarmup=20;
+        unsigned int seed=1234;
+        Size size(640,480);
+        string outFile,onlyKernel;
+        int idx;
+        if ((idx=findParam("-o",argc,argv))!=-1) outFile=argv[idx+1];
+        if ((idx=findParam("-reps",argc,argv))!=-1) nReps=std::max(1,atoi(argv[idx+1]));
+        if ((idx=findParam("-warmup",argc,argv))!=-1) nWarmup=std::max(0,atoi(argv[idx+1]));
+        if ((idx=findParam("-seed",argc,argv))!=-1) seed=atoi(argv[idx+1]);
+        if ((idx=findParam("-size",argc,argv))!=-1) sscanf(argv[idx+1],"%dx%d",&size.width,&size.height);
+        if ((idx=findParam("-k",argc,argv))!=-1) onlyKernel=argv[idx+1];
+
+        BenchInput in;
+        createInput(in,size,seed);
+        cout<<"Input: "<<size.width<<"x"<<size.height<<" candidates="<<in.candidates.size()<<" markers="<<in.markers.size()
+            <<" boardMarkers="<<in.boardMarkers.size()<<endl;
+
+        vector<Kernel*> kernels;
+        kernels.push_back(new ThresholdKernel("thresHold(FIXED_THRES)",in,MarkerDetector::FIXED_THRES,100,0));
+        kernels.push_back(new ThresholdKernel("thresHold(ADPT_THRES)",in,MarkerDetector::ADPT_THRES));
+        kernels.push_back(new ThresholdKernel("thresHold(CANNY)",in,MarkerDetector::CANNY));
+        kernels.push_back(new ThresholdKernel("thresHold(EDGE_SEGMENTS)",in,MarkerDetector::EDGE_SEGMENTS));
+        kernels.push_back(new DetectRectanglesKernel(in));
+        kernels.push_back(new DetectSegmentQuadsKernel(in));
+        kernels.push_back(new WarpKernel(in));
+        kernels.push_back(new WarpCylinderKernel(in));
+        kernels.push_back(new HammingDecodeKernel(in));
+        kernels.push_back(new HRMDetectKernel(in));
+        kernels.push_back(new CornerSubPixKernel(in));
+        kernels.push_back(new HarrisKernel(in));
+        kernels.push_back(new LinesKernel(in));
+        kernels.push_back(new SubPixelCornerKernel(in));
+        kernels.push_back(new ExtrinsicsKernel(in));
+        kernels.push_back(new BoardDetectorKernel(in));
+
+        FileStorage fs;
+        if (!outFile.empty()) {
+            fs.open(outFile,FileStorage::WRITE);
+            if (!fs.isOpened()) {
+                cerr<<"Could not open "<<outFile<<endl;
+                return -1;
+            }
+            fs<<"width"<<size.width<<"height"<<size.height<<"seed"<<int(seed)<<"reps"<<nReps<<"warmup"<<nWarmup;
+            fs<<"kernels"<<"[";
+        }
+        printf("%-32s %10s %10s %10s %10s\n","kernel","median(ms)","p99(ms)","mean(ms)","min(ms)");
+        for (size_t i=0;i<kernels.size();i++) {
+            if (onlyKernel.empty() || kernels[i]->name==onlyKernel) {
+                KernelTimes kt=measure(*kernels[i],nWarmup,nReps);
+                printf("%-32s %10.4f %10.4f %10.4f %10.4f\n",kernels[i]->name.c_str(),kt.median,kt.p99,kt.mean,kt.min);
+                if (fs.isOpened())
+                    fs<<"{"<<"name"<<kernels[i]->name<<"median"<<kt.median<<"p99"<<kt.p99<<"mean"<<kt.mean<<"min"<<kt.min<<"}";
+            }
+            delete kernels[i];
+        }
+        if (fs.isOpened()) {
+            fs<<"]";
+            fs.release();
+        }
+    } catch (std::exception &ex)
+    {
+        cout<<"Exception :"<<ex.what()<<endl;
+    }
+}
@@ -0,0 +1,241 @@
+/*****************************
+Copyright 2011 Rafael Muñoz Salinas. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY Rafael Muñoz Salinas ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Rafael Muñoz Salinas OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of Rafael Muñoz Salinas.
+********************************/
+#include "syntheticscene.h"
+#include <set>
+#include <cmath>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include "arucofidmarkers.h"
+#include "hammingcode.h"
+using namespace std;
+using namespace cv;
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+SyntheticSceneGenerator::Params::Params()
+{
+    imageSize=Size(640,480);
+    nMarkers=6;
+    minScale=0.4;
+    maxScale=1;
+    maxPerspective=0.1;
+    maxBlurSigma=1.5;
+    noiseSigma=4;
+    maxGradient=0.3;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+SyntheticSceneGenerator::SyntheticSceneGenerator(const Params &p,uint64 seed):_params(p),_rng(seed)
+{
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void SyntheticSceneGenerator::setBackgrounds(const vector<Mat> &backgrounds)
+{
+    _backgrounds.clear();
+    for (size_t i=0;i<backgrounds.size();i++) {
+        Mat grey;
+        if (backgrounds[i].type()==CV_8UC3) cvtColor(backgrounds[i],grey,CV_BGR2GRAY);
+        else grey=backgrounds[i];
+        _backgrounds.push_back(Mat());
+        resize(grey,_backgrounds.back(),_params.imageSize);
+    }
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+int SyntheticSceneGenerator::loadBackgrounds(const vector<string> &paths)
+{
+    vector<Mat> images;
+    for (size_t i=0;i<paths.size();i++) {
+        Mat im=imread(paths[i]);
+        if (!im.empty()) images.push_back(im);
+    }
+    setBackgrounds(images);
+    return images.size();
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void SyntheticSceneGenerator::createBackground(Mat &bg)
+{
+    if (!_backgrounds.empty()) {
+        _backgrounds[_rng.uniform(0,int(_backgrounds.size()))].copyTo(bg);
+        return;
+    }
+    //procedural clutter: rectangles, circles and lines of random grey levels
+    Size size=_params.imageSize;
+    bg.create(size,CV_8UC1);
+    bg.setTo(Scalar(_rng.uniform(60,200)));
+    int nElements=20+size.area()/20000;
+    for (int i=0;i<nElements;i++) {
+        Point p1(_rng.uniform(0,size.width),_rng.uniform(0,size.height));
+        Point p2(_rng.uniform(0,size.width),_rng.uniform(0,size.height));
+        Scalar color(_rng.uniform(0,256));
+        switch (i%3) {
+        case 0:
+            rectangle(bg,p1,p2,color,-1);
+            break;
+        case 1:
+            circle(bg,p1,_rng.uniform(2,1+std::min(size.width,size.height)/8),color,-1);
+            break;
+        case 2:
+            line(bg,p1,p2,color,_rng.uniform(1,6));
+            break;
+        };
+    }
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+vector<Point2f> SyntheticSceneGenerator::placeMarker(Mat &img32f,int id,const Rect &cell)
+{
+    float cellSide=std::min(cell.width,cell.height);
+    //the marker plus its quiet zone (9/7 of the marker) must fit in the cell for any rotation and perspective
+    float maxSide=cellSide/ ( (9./7.) *sqrt(2.) * (1+2*_params.maxPerspective) );
+    float side=_rng.uniform(_params.minScale,_params.maxScale)*maxSide;
+
+    //create the marker with enough resolution and add the white quiet zone
+    int ms=std::max(70, 7*cvRound(side/7.));
+    int q=ms/7;
+    Mat marker=aruco::FiducidalMarkers<nkdhny::HammingCode>::createMarkerImage(id,ms,false);
+    Mat padded;
+    copyMakeBorder(marker,padded,q,q,q,q,BORDER_CONSTANT,Scalar(255));
+    Mat padded32f;
+    padded.convertTo(padded32f,CV_32F);
+
+    //corners of the black square. Pixel centers are at integer coordinates, so the edges are at -0.5
+    Point2f src[4]={Point2f(q-0.5f,q-0.5f),Point2f(q+ms-0.5f,q-0.5f),Point2f(q+ms-0.5f,q+ms-0.5f),Point2f(q-0.5f,q+ms-0.5f)};
+    //destination in the cell: rotated square with random displacement of the corners
+    double angle=_rng.uniform(0.,2*CV_PI);
+    float ca=cos(angle),sa=sin(angle),h=side/2.;
+    Point2f center(cell.width/2.f,cell.height/2.f);
+    float signs[4][2]={{-1,-1},{1,-1},{1,1},{-1,1}};
+    Point2f dst[4];
+    vector<Point2f> corners(4);
+    for (int i=0;i<4;i++) {
+        float x=signs[i][0]*h,y=signs[i][1]*h;
+        dst[i]=center+Point2f(ca*x-sa*y,sa*x+ca*y);
+        dst[i]+=Point2f(_rng.uniform(-_params.maxPerspective,_params.maxPerspective)*side,
+                        _rng.uniform(-_params.maxPerspective,_params.maxPerspective)*side);
+        corners[i]=dst[i]+Point2f(cell.x,cell.y);
+    }
+    Mat H=getPerspectiveTransform(src,dst);
+
+    //warp the marker and its coverage, and blend. The warped marker is premultiplied by its coverage since the border is 0
+    Mat warped,coverage,invCoverage;
+    warpPerspective(padded32f,warped,H,cell.size(),INTER_LINEAR,BORDER_CONSTANT,Scalar(0));
+    warpPerspective(Mat::ones(padded.size(),CV_32F),coverage,H,cell.size(),INTER_LINEAR,BORDER_CONSTANT,Scalar(0));
+    invCoverage=1.-coverage;
+    Mat roi=img32f(cell);
+    Mat blended=roi.mul(invCoverage)+warped;
+    blended.copyTo(roi);
+    return corners;
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+SyntheticScene SyntheticSceneGenerator::generate()
+{
+    SyntheticScene scene;
+    Size size=_params.imageSize;
+    Mat bg,img32f;
+    createBackground(bg);
+    bg.convertTo(img32f,CV_32F);
+
+    //select distinct ids
+    set<int> ids;
+    int nMarkers=std::min(_params.nMarkers,1024);
+    while (int(ids.size())<nMarkers) ids.insert(_rng.uniform(0,1024));
+
+    //place each marker in a cell of the grid
+    int gridCols=std::max(1,int(ceil(sqrt(double(nMarkers)))));
+    int gridRows=std::max(1,(nMarkers+gridCols-1)/gridCols);
+    int cellW=size.width/gridCols,cellH=size.height/gridRows;
+    int idx=0;
+    for (set<int>::iterator it=ids.begin();it!=ids.end();++it,idx++) {
+        Rect cell((idx%gridCols)*cellW,(idx/gridCols)*cellH,cellW,cellH);
+        SyntheticMarker sm;
+        sm.id=*it;
+        sm.corners=placeMarker(img32f,sm.id,cell);
+        scene.markers.push_back(sm);
+    }
+
+    //lighting gradient
+    double gx=_rng.uniform(-_params.maxGradient,_params.maxGradient);
+    double gy=_rng.uniform(-_params.maxGradient,_params.maxGradient);
+    float cx=size.width/2.f,cy=size.height/2.f;
+    for (int y=0;y<img32f.rows;y++) {
+        float *row=img32f.ptr<float>(y);
+        for (int x=0;x<img32f.cols;x++)
+            row[x]*=1+gx*(x-cx)/cx+gy*(y-cy)/cy;
+    }
+    //blur
+    double sigma=_rng.uniform(0.,_params.maxBlurSigma);
+    if (sigma>0.3) GaussianBlur(img32f,img32f,Size(0,0),sigma);
+    //noise
+    if (_params.noiseSigma>0) {
+        Mat noise(size,CV_32F);
+        _rng.fill(noise,RNG::NORMAL,Scalar(0),Scalar(_params.noiseSigma));
+        img32f+=noise;
+    }
+    Mat grey;
+    img32f.convertTo(grey,CV_8U);
+    cvtColor(grey,scene.image,CV_GRAY2BGR);
+    return scene;
+}
@@ -0,0 +1,109 @@
+/*****************************
+Copyright 2011 Rafael Muñoz Salinas. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY Rafael Muñoz Salinas ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Rafael Muñoz Salinas OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed
+or implied, of Rafael Muñoz Salinas.
+********************************/
+#ifndef _ARUCO_BENCH_SyntheticScene_H
+#define _ARUCO_BENCH_SyntheticScene_H
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include <string>
+
+/**\brief A marker placed in a synthetic scene, with its ground truth
+ */
+struct SyntheticMarker
+{
+    int id;
+    //corners in the image in the same order the detector reports them (top-left, top-right, bottom-right, bottom-left of the printed marker)
+    std::vector<cv::Point2f> corners;
+};
+
+/**\brief Image and ground truth produced by SyntheticSceneGenerator
+ */
+struct SyntheticScene
+{
+    cv::Mat image;//BGR image
+    std::vector<SyntheticMarker> markers;
+};
+
+/**\brief Creates images with aruco markers at known positions.
+ *
+ * Markers created with FiducidalMarkers::createMarkerImage are surrounded by a white quiet zone and composited into a
+ * background by means of a random homography. Afterwards, a lighting gradient, blur and gaussian noise are applied.
+ * The generator is seeded, so that the same sequence of scenes is obtained in every run.
+ */
+class SyntheticSceneGenerator
+{
+public:
+    struct Params
+    {
+        Params();
+        cv::Size imageSize;
+        //number of markers in each scene. They are placed in a grid so that they never overlap
+        int nMarkers;
+        //min and max size of the marker side, as a fraction of the grid cell side
+        float minScale,maxScale;
+        //max displacement of each corner (fraction of the marker side) to create the perspective effect
+        float maxPerspective;
+        //max sigma of the gaussian blur. The sigma of each scene is uniformly selected in [0,maxBlurSigma]
+        double maxBlurSigma;
+        //sigma of the gaussian noise added (gray levels)
+        double noiseSigma;
+        //max relative variation of the illumination from the center to the borders of the image
+        double maxGradient;
+    };
+
+    /**
+     * @param p parameters of the scenes
+     * @param seed seed of the random number generator
+     */
+    SyntheticSceneGenerator(const Params &p,uint64 seed=0x12345678);
+
+    /**Sets the images employed as background. If none is set, a procedural cluttered background is created
+     */
+    void setBackgrounds(const std::vector<cv::Mat> &backgrounds);
+
+    /**Reads background images from a list of files
+     * @return number of images read
+     */
+    int loadBackgrounds(const std::vector<std::string> &paths);
+
+    /**Creates the next scene
+     */
+    SyntheticScene generate();
+
+    const Params & getParams()const{return _params;}
+private:
+
+    void createBackground(cv::Mat &bg);
+    //composites the marker into the float image. Returns the corners of the marker
+    std::vector<cv::Point2f> placeMarker(cv::Mat &img32f,int id,const cv::Rect &cell);
+
+    Params _params;
+    cv::RNG _rng;
+    std::vector<cv::Mat> _backgrounds;
+};
+
+#endif